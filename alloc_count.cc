@@ -0,0 +1,110 @@
+#include "alloc_count.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+
+/// glibc only: forward to the real allocator through its __libc_ entry points
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+void __libc_free(void*);
+}
+
+#define ALLOC_WARMUP 10
+
+static thread_local unsigned long allocs = 0;
+static std::atomic<unsigned long> credited(0); /// from helper threads
+
+extern "C" void* malloc(size_t n)
+{
+    allocs++;
+    return __libc_malloc(n);
+}
+
+extern "C" void* calloc(size_t n, size_t sz)
+{
+    allocs++;
+    return __libc_calloc(n, sz);
+}
+
+extern "C" void* realloc(void* p, size_t n)
+{
+    allocs++;
+    return __libc_realloc(p, n);
+}
+
+/// the aligned entry points don't go through malloc inside glibc, c++17
+/// aligned new ends up in aligned_alloc
+extern "C" void* memalign(size_t align, size_t n)
+{
+    allocs++;
+    return __libc_memalign(align, n);
+}
+
+extern "C" void* aligned_alloc(size_t align, size_t n)
+{
+    allocs++;
+    return __libc_memalign(align, n);
+}
+
+extern "C" int posix_memalign(void** p, size_t align, size_t n)
+{
+    if (align % sizeof(void*) || (align & (align - 1))) return EINVAL;
+    allocs++;
+    void* r = __libc_memalign(align, n);
+    if (!r) return ENOMEM;
+    *p = r;
+    return 0;
+}
+
+extern "C" void* valloc(size_t n)
+{
+    allocs++;
+    return __libc_memalign(getpagesize(), n);
+}
+
+extern "C" void* pvalloc(size_t n)
+{
+    size_t page = getpagesize();
+    allocs++;
+    return __libc_memalign(page, (n + page - 1) & ~(page - 1));
+}
+
+extern "C" void free(void* p)
+{
+    __libc_free(p);
+}
+
+unsigned long alloc_count()
+{
+    return allocs + credited.load(std::memory_order_relaxed);
+}
+
+unsigned long alloc_count_thread()
+{
+    return allocs;
+}
+
+void alloc_count_credit(unsigned long n)
+{
+    if (n) credited.fetch_add(n, std::memory_order_relaxed);
+}
+
+void alloc_check_frame(const char* where, unsigned int frame, unsigned long since)
+{
+    unsigned long n = alloc_count() - since;
+    if (frame < ALLOC_WARMUP || n == 0) return;
+
+    fprintf(stderr, "%s: frame %u did %lu heap allocations\n", where, frame, n);
+    const char* strict = getenv("NAVGUIDE_ALLOC_ASSERT");
+    if (strict && *strict == '1') {
+        abort();
+    }
+}
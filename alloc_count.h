@@ -0,0 +1,28 @@
+#ifndef NAVGUIDE_ALLOC_COUNT_H
+#define NAVGUIDE_ALLOC_COUNT_H
+
+/// heap allocation counting for benchmark builds (-DUSE_ALLOC_COUNT=ON).
+/// alloc_count.cc interposes malloc and friends, which also covers
+/// operator new. counts are per thread, so the capture writer and the nav
+/// worker do not show up in the render thread's numbers. the view render
+/// workers draw the render thread's frame, they hand what they allocated
+/// to it with alloc_count_credit().
+///
+/// alloc_check_frame() reports a frame that touched the heap once the loop
+/// is past its warm up; NAVGUIDE_ALLOC_ASSERT=1 turns that into an abort.
+
+#ifdef USE_ALLOC_COUNT
+/// this thread's allocations plus everything credited so far
+unsigned long alloc_count();
+/// this thread's allocations alone
+unsigned long alloc_count_thread();
+void alloc_count_credit(unsigned long n);
+void alloc_check_frame(const char* where, unsigned int frame, unsigned long since);
+#else
+static inline unsigned long alloc_count() { return 0; }
+static inline unsigned long alloc_count_thread() { return 0; }
+static inline void alloc_count_credit(unsigned long) {}
+static inline void alloc_check_frame(const char*, unsigned int, unsigned long) {}
+#endif
+
+#endif
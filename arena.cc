@@ -0,0 +1,82 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_INITIAL (256 * 1024)
+
+typedef struct _Spill Spill;
+struct _Spill {
+    Spill* next;
+};
+
+static struct {
+    unsigned char* base;
+    size_t cap;
+    size_t used;
+    size_t frame_total; /// used + spilled this frame
+    size_t high_water;
+    Spill* spills;
+} arena;
+
+static inline size_t align_up(size_t n)
+{
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void* frame_alloc(size_t size)
+{
+    size = align_up(size);
+    if (!arena.base) {
+        arena.cap = ARENA_INITIAL;
+        arena.base = (unsigned char*)malloc(arena.cap);
+    }
+
+    arena.frame_total += size;
+    if (arena.used + size <= arena.cap) {
+        void* p = arena.base + arena.used;
+        arena.used += size;
+        return p;
+    }
+
+    // overflow, serve from the heap until the next reset regrows the block
+    Spill* s = (Spill*)malloc(align_up(sizeof(Spill)) + size);
+    if (!s) return NULL;
+    s->next = arena.spills;
+    arena.spills = s;
+    return (unsigned char*)s + align_up(sizeof(Spill));
+}
+
+void frame_reset()
+{
+    if (arena.frame_total > arena.high_water) {
+        arena.high_water = arena.frame_total;
+    }
+
+    if (arena.spills) {
+        while (arena.spills) {
+            Spill* s = arena.spills;
+            arena.spills = s->next;
+            free(s);
+        }
+
+        // headroom so a slowly growing population does not regrow every frame
+        free(arena.base);
+        arena.cap = align_up(arena.high_water + arena.high_water / 4);
+        arena.base = (unsigned char*)malloc(arena.cap);
+    }
+
+    arena.used = 0;
+    arena.frame_total = 0;
+}
+
+size_t frame_capacity()
+{
+    return arena.cap;
+}
+
+size_t frame_high_water()
+{
+    return arena.high_water;
+}
@@ -0,0 +1,24 @@
+#ifndef NAVGUIDE_ARENA_H
+#define NAVGUIDE_ARENA_H
+
+#include <stddef.h>
+
+/// per-frame linear arena for temporary buffers. allocations are bump
+/// pointer only and live until frame_reset() at the end of the frame.
+/// a frame that outgrows the block spills into heap chunks once, the
+/// next reset grows the block to the high water mark so steady state
+/// frames never touch the heap.
+
+void* frame_alloc(size_t size);
+void frame_reset();
+
+size_t frame_capacity();
+size_t frame_high_water();
+
+template <class T>
+static inline T* frame_alloc_array(size_t n)
+{
+    return (T*)frame_alloc(n * sizeof(T));
+}
+
+#endif
@@ -0,0 +1,341 @@
+#include "behavior.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "wheel.h"
+
+using namespace std;
+
+//
+// coroutine frame pool
+//
+
+#define FRAME_ALIGN 64
+#define FRAME_CLASSES 32 /// pooled up to FRAME_ALIGN * FRAME_CLASSES bytes
+#define FRAME_CHUNK (64 * 1024)
+
+typedef struct FreeFrame {
+    struct FreeFrame* next;
+} FreeFrame;
+
+static struct {
+    FreeFrame* free[FRAME_CLASSES];
+    char* cur;    /// carve point in the newest chunk
+    char* end;
+    vector<void*> chunks;
+} pool;
+
+void* behavior_frame_alloc(size_t size)
+{
+    size_t cls = (size + FRAME_ALIGN - 1) / FRAME_ALIGN;
+    if (cls > FRAME_CLASSES) {
+        return malloc(size);
+    }
+
+    FreeFrame*& head = pool.free[cls - 1];
+    if (head) {
+        void* p = head;
+        head = head->next;
+        return p;
+    }
+
+    size_t n = cls * FRAME_ALIGN;
+    if (pool.cur + n > pool.end) {
+        pool.cur = (char*)malloc(FRAME_CHUNK);
+        if (!pool.cur) abort();
+        pool.end = pool.cur + FRAME_CHUNK;
+        pool.chunks.push_back(pool.cur);
+    }
+    void* p = pool.cur;
+    pool.cur += n;
+    return p;
+}
+
+void behavior_frame_free(void* p, size_t size)
+{
+    size_t cls = (size + FRAME_ALIGN - 1) / FRAME_ALIGN;
+    if (cls > FRAME_CLASSES) {
+        free(p);
+        return;
+    }
+
+    FreeFrame* f = (FreeFrame*)p;
+    f->next = pool.free[cls - 1];
+    pool.free[cls - 1] = f;
+}
+
+//
+// scheduler
+//
+
+enum {
+    AGENT_IDLE = 0,
+    AGENT_READY,   /// queued to resume
+    AGENT_WAITING, /// on a timer and/or a signal
+    AGENT_RUNNING,
+};
+
+enum {
+    AWAIT_TICK, AWAIT_DELAY, AWAIT_WAIT
+};
+
+typedef struct {
+    coroutine_handle<> root;
+    coroutine_handle<> resume; /// innermost suspended frame
+    short state;
+    bool queued;     /// has an entry in ready or next, maybe a stale one
+    bool signalled;  /// how the last behavior_wait() ended
+    int timer;       /// wheel timer, -1 for none
+    unsigned int expires;
+    BehaviorSignal* sig; /// signal waited on, NULL for none
+    int prev, next;  /// waiter list of sig
+} Agent;
+
+static struct {
+    vector<Agent> agents;
+    /// fixed capacity, an agent is never queued twice so these never grow
+    vector<int> ready, next;
+    unsigned int now;
+    int current; /// agent being resumed, -1 outside behavior_run()
+    int resumed;
+    int live;
+    bool warned;
+} sched;
+
+static void make_ready(int id)
+{
+    Agent& a = sched.agents[id];
+    a.state = AGENT_READY;
+    if (!a.queued) {
+        a.queued = true;
+        // wakes from inside a run wait a frame, so agents can't ping-pong
+        // forever within one
+        (sched.current >= 0 ? sched.next : sched.ready).push_back(id);
+    }
+}
+
+static void unlink_waiter(int id)
+{
+    Agent& a = sched.agents[id];
+    if (a.prev >= 0) {
+        sched.agents[a.prev].next = a.next;
+    } else {
+        a.sig->head = a.next + 1;
+    }
+    if (a.next >= 0) sched.agents[a.next].prev = a.prev;
+    a.sig = NULL;
+}
+
+/// wheel callback
+static void wake_timer(int id, unsigned int)
+{
+    Agent& a = sched.agents[id];
+    a.timer = -1;
+    if (a.sig) {
+        unlink_waiter(id);
+        a.signalled = false;
+    }
+    make_ready(id);
+}
+
+void behavior_init(unsigned int now, int capacity)
+{
+    behavior_shutdown();
+
+    Agent idle;
+    idle.state = AGENT_IDLE;
+    idle.queued = idle.signalled = false;
+    idle.timer = -1;
+    idle.expires = 0;
+    idle.sig = NULL;
+    idle.prev = idle.next = -1;
+    sched.agents.assign(capacity, idle);
+
+    sched.ready.clear();
+    sched.next.clear();
+    sched.ready.reserve(capacity);
+    sched.next.reserve(capacity);
+    sched.now = now;
+    sched.current = -1;
+    sched.resumed = sched.live = 0;
+}
+
+void behavior_shutdown()
+{
+    for (size_t i = 0; i < sched.agents.size(); i++) {
+        behavior_stop(i);
+    }
+    sched.agents.clear();
+
+    for (size_t i = 0; i < pool.chunks.size(); i++) {
+        free(pool.chunks[i]);
+    }
+    pool.chunks.clear();
+    for (int i = 0; i < FRAME_CLASSES; i++) pool.free[i] = NULL;
+    pool.cur = pool.end = NULL;
+}
+
+void behavior_start(int agent, Behavior b, unsigned int delay)
+{
+    behavior_stop(agent);
+
+    Agent& a = sched.agents[agent];
+    a.root = a.resume = b.release();
+    sched.live++;
+    if (delay) {
+        a.state = AGENT_WAITING;
+        a.expires = sched.now + delay;
+        a.timer = wheel_add(a.expires, wake_timer, agent);
+        if (a.timer >= 0) return;
+    }
+    make_ready(agent);
+}
+
+void behavior_stop(int agent)
+{
+    Agent& a = sched.agents[agent];
+    if (!a.root) return;
+
+    wheel_cancel(a.timer);
+    a.timer = -1;
+    if (a.sig) unlink_waiter(agent);
+    a.root.destroy();
+    a.root = a.resume = coroutine_handle<>();
+    a.state = AGENT_IDLE;
+    sched.live--;
+}
+
+bool behavior_running(int agent)
+{
+    return (bool)sched.agents[agent].root;
+}
+
+int behavior_timeout(int agent, unsigned int now)
+{
+    const Agent& a = sched.agents[agent];
+    if (a.timer < 0) return -1;
+    int left = a.expires - now;
+    return left > 0 ? left : 0;
+}
+
+bool behavior_ready(int agent, bool* signalled)
+{
+    const Agent& a = sched.agents[agent];
+    bool ready = a.state == AGENT_READY;
+    if (signalled) *signalled = ready && a.signalled;
+    return ready;
+}
+
+void behavior_run(unsigned int now)
+{
+    sched.now = now;
+    for (size_t i = 0; i < sched.next.size(); i++) {
+        sched.ready.push_back(sched.next[i]);
+    }
+    sched.next.clear();
+
+    sched.resumed = 0;
+    for (size_t i = 0; i < sched.ready.size(); i++) {
+        int id = sched.ready[i];
+        Agent& a = sched.agents[id];
+        a.queued = false;
+        if (a.state != AGENT_READY) continue; // stopped since
+
+        a.state = AGENT_RUNNING;
+        sched.current = id;
+        a.resume.resume();
+        sched.current = -1;
+        sched.resumed++;
+
+        if (a.root.done()) {
+            a.root.destroy();
+            a.root = a.resume = coroutine_handle<>();
+            a.state = AGENT_IDLE;
+            sched.live--;
+        }
+    }
+    sched.ready.clear();
+}
+
+void behavior_notify(BehaviorSignal* sig)
+{
+    int id = sig->head - 1;
+    sig->head = 0;
+    while (id >= 0) {
+        Agent& a = sched.agents[id];
+        int next = a.next;
+        a.sig = NULL;
+        a.prev = a.next = -1;
+        a.signalled = true;
+        wheel_cancel(a.timer);
+        a.timer = -1;
+        make_ready(id);
+        id = next;
+    }
+}
+
+int behavior_resumed()
+{
+    return sched.resumed;
+}
+
+int behavior_live()
+{
+    return sched.live;
+}
+
+void BehaviorAwait::await_suspend(coroutine_handle<> h)
+{
+    int id = sched.current;
+    Agent& a = sched.agents[id];
+    a.resume = h;
+    a.state = AGENT_WAITING;
+
+    if (kind == AWAIT_WAIT) {
+        a.signalled = false;
+        a.sig = sig;
+        a.prev = -1;
+        a.next = sig->head - 1;
+        if (a.next >= 0) sched.agents[a.next].prev = id;
+        sig->head = id + 1;
+    }
+
+    if (kind == AWAIT_TICK || (kind == AWAIT_DELAY && ms == 0)) {
+        make_ready(id);
+    } else if (ms) {
+        a.expires = sched.now + ms;
+        a.timer = wheel_add(a.expires, wake_timer, id);
+        if (a.timer < 0) {
+            // wheel sized too small, poll every frame instead of stalling
+            if (!sched.warned) {
+                fprintf(stderr, "behavior: timing wheel full, delays degrade to ticks\n");
+                sched.warned = true;
+            }
+            if (a.sig) unlink_waiter(id);
+            make_ready(id);
+        }
+    }
+}
+
+bool BehaviorAwait::await_resume()
+{
+    return kind != AWAIT_WAIT || sched.agents[sched.current].signalled;
+}
+
+BehaviorAwait behavior_tick()
+{
+    return (BehaviorAwait) { AWAIT_TICK, 0, NULL };
+}
+
+BehaviorAwait behavior_delay(unsigned int ms)
+{
+    return (BehaviorAwait) { AWAIT_DELAY, ms, NULL };
+}
+
+BehaviorAwait behavior_wait(BehaviorSignal* sig, unsigned int timeout)
+{
+    return (BehaviorAwait) { AWAIT_WAIT, timeout, sig };
+}
@@ -0,0 +1,142 @@
+#ifndef NAVGUIDE_BEHAVIOR_H
+#define NAVGUIDE_BEHAVIOR_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <coroutine>
+
+/// scripted agent behaviours as C++20 coroutines.
+///
+/// an agent is an index (the sprite slot) running one Behavior. a script
+/// suspends on behavior_tick(), behavior_delay() or behavior_wait() and the
+/// scheduler only ever touches agents that became runnable: delays sit on
+/// the timing wheel, signals keep their own waiter lists, and
+/// behavior_run() resumes whatever was woken, so a frame costs the number
+/// of agents that resume, not the number of agents.
+///
+/// a script may co_await another Behavior to run it as a sub-behaviour of
+/// the same agent. coroutine frames come from size class free lists, so
+/// once warmed up starting and finishing behaviours never touches the heap.
+///
+/// render thread only. delays use the timing wheel, size it for one timer
+/// per agent on top of everything else.
+
+void* behavior_frame_alloc(size_t size);
+void behavior_frame_free(void* p, size_t size);
+
+class Behavior {
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    struct promise_type {
+        std::coroutine_handle<> parent; /// awaiting behaviour, none for a root
+
+        struct Final {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(Handle h) noexcept
+            {
+                std::coroutine_handle<> p = h.promise().parent;
+                return p ? p : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        Behavior get_return_object() { return Behavior(Handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        Final final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { abort(); }
+
+        static void* operator new(size_t size) { return behavior_frame_alloc(size); }
+        static void operator delete(void* p, size_t size) { behavior_frame_free(p, size); }
+    };
+
+    Behavior() : h() {}
+    Behavior(Behavior&& o) : h(o.h) { o.h = Handle(); }
+    Behavior& operator=(Behavior&& o)
+    {
+        if (this != &o) {
+            if (h) h.destroy();
+            h = o.h;
+            o.h = Handle();
+        }
+        return *this;
+    }
+    Behavior(const Behavior&) = delete;
+    Behavior& operator=(const Behavior&) = delete;
+    ~Behavior() { if (h) h.destroy(); }
+
+    /// co_await sub_behaviour(...) runs it to completion in the caller's agent
+    bool await_ready() { return !h || h.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller)
+    {
+        h.promise().parent = caller;
+        return h;
+    }
+    void await_resume() {}
+
+    Handle release()
+    {
+        Handle r = h;
+        h = Handle();
+        return r;
+    }
+
+private:
+    explicit Behavior(Handle h) : h(h) {}
+    Handle h;
+};
+
+/// condition agents can sleep on, raised by game code with behavior_notify().
+/// zeroed is a signal nobody waits on, fine inside memset slabs.
+typedef struct {
+    int head; /// first waiting agent + 1, 0 for none
+} BehaviorSignal;
+
+void behavior_init(unsigned int now, int capacity);
+void behavior_shutdown();
+
+/// replace whatever agent runs with b, first resumed delay ms from now.
+/// neither may be called on an agent from its own script.
+void behavior_start(int agent, Behavior b, unsigned int delay = 0);
+void behavior_stop(int agent);
+bool behavior_running(int agent);
+
+/// ms until the agent's pending delay expires, -1 when it is not sleeping
+int behavior_timeout(int agent, unsigned int now);
+/// the agent is woken and resumes in the next behavior_run(). signalled
+/// tells whether the behavior_wait() it was in ended on its signal.
+bool behavior_ready(int agent, bool* signalled = NULL);
+
+/// resume every runnable agent, once per frame after wheel_advance()
+void behavior_run(unsigned int now);
+
+/// wake every agent waiting on sig, they resume in the current or next
+/// behavior_run()
+void behavior_notify(BehaviorSignal* sig);
+
+/// agents resumed by the last behavior_run(), and live agents
+int behavior_resumed();
+int behavior_live();
+
+struct BehaviorAwait {
+    int kind;
+    unsigned int ms;
+    BehaviorSignal* sig;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    /// for behavior_wait(): true when signalled, false on timeout
+    bool await_resume();
+};
+
+/// resume on the next frame
+BehaviorAwait behavior_tick();
+/// resume once ms have passed on the frame clock
+BehaviorAwait behavior_delay(unsigned int ms);
+/// resume when sig is raised, or after timeout ms unless timeout is 0
+BehaviorAwait behavior_wait(BehaviorSignal* sig, unsigned int timeout = 0);
+
+#endif
@@ -0,0 +1,164 @@
+#include <SDL.h>
+#include <cairo.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "composite.h"
+
+/// composite_over and composite_fill at every level the cpu has, against
+/// the generic paths they replace: SDL_BlitSurface and SDL_FillRects on the
+/// SDL software path, cairo OVER on the GTK path. sizes are the ones the
+/// frame loop draws, 48x48 sprites and 10x10 trail squares, at random
+/// spots of an 800x600 window. prints ns per sprite or square.
+
+#define WIN_W 800
+#define WIN_H 600
+#define SPRITE 48
+#define TRAIL 10
+#define OPS 200000
+#define BATCH 1000 /// rects per SDL_FillRects call, draw_trails() batches too
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static mt19937 rng(1);
+static vector<int> xs, ys;
+
+static double ns_per_op(Clock::time_point t0)
+{
+    return chrono::duration<double, nano>(Clock::now() - t0).count() / OPS;
+}
+
+static void random_spots(int size)
+{
+    xs.resize(OPS), ys.resize(OPS);
+    for (int i = 0; i < OPS; i++) {
+        xs[i] = rng() % (WIN_W - size);
+        ys[i] = rng() % (WIN_H - size);
+    }
+}
+
+/// opaque middle, translucent rim, transparent corners, like sprite.png
+static void sprite_pixels(uint32_t* px)
+{
+    for (int y = 0; y < SPRITE; y++) {
+        for (int x = 0; x < SPRITE; x++) {
+            int dx = 2*x - SPRITE, dy = 2*y - SPRITE, d = dx*dx + dy*dy;
+            int a = d < 30*30 ? 0xff : d < SPRITE*SPRITE ? 0x80 : 0;
+            px[y * SPRITE + x] = composite_rgba(rng() % 256, rng() % 256, rng() % 256, a);
+        }
+    }
+}
+
+static void bench_composite(vector<uint32_t>& win, const Pixmap* sprite, uint32_t color)
+{
+    Pixmap dst = pixmap_wrap(win.data(), WIN_W, WIN_H, WIN_W * 4);
+    CompositeImpl best = composite_select(COMPOSITE_AVX2);
+    for (int impl = COMPOSITE_SCALAR; impl <= best; impl++) {
+        const char* name = composite_impl_name(composite_select((CompositeImpl)impl));
+
+        random_spots(SPRITE);
+        Clock::time_point t0 = Clock::now();
+        for (int i = 0; i < OPS; i++) {
+            composite_over(&dst, xs[i], ys[i], sprite, 0, 0, SPRITE, SPRITE);
+        }
+        printf("over %dx%d  composite %-6s %7.1f ns\n", SPRITE, SPRITE, name, ns_per_op(t0));
+
+        random_spots(TRAIL);
+        t0 = Clock::now();
+        for (int i = 0; i < OPS; i++) {
+            composite_fill(&dst, xs[i], ys[i], TRAIL, TRAIL, color);
+        }
+        printf("fill %dx%d  composite %-6s %7.1f ns\n", TRAIL, TRAIL, name, ns_per_op(t0));
+    }
+}
+
+static void bench_sdl(const uint32_t* sprite_px)
+{
+    SDL_Surface* win = SDL_CreateRGBSurfaceWithFormat(0, WIN_W, WIN_H, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Surface* spr = SDL_CreateRGBSurfaceWithFormat(0, SPRITE, SPRITE, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (!win || !spr) {
+        fprintf(stderr, "SDL surfaces failed: %s\n", SDL_GetError());
+        return;
+    }
+    for (int y = 0; y < SPRITE; y++) {
+        memcpy((uint8_t*)spr->pixels + y * spr->pitch, &sprite_px[y * SPRITE], SPRITE * 4);
+    }
+    // SDL takes the premultiplied pixels for straight alpha, the colors
+    // come out wrong but the blending work is the same
+    SDL_SetSurfaceBlendMode(spr, SDL_BLENDMODE_BLEND);
+
+    random_spots(SPRITE);
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < OPS; i++) {
+        SDL_Rect pos = { xs[i], ys[i], SPRITE, SPRITE };
+        SDL_BlitSurface(spr, NULL, win, &pos);
+    }
+    printf("over %dx%d  SDL_BlitSurface  %7.1f ns\n", SPRITE, SPRITE, ns_per_op(t0));
+
+    // SDL_FillRects writes the color without blending, so this is a lower
+    // bound for a blended fill
+    random_spots(TRAIL);
+    vector<SDL_Rect> rects(OPS);
+    for (int i = 0; i < OPS; i++) {
+        rects[i] = (SDL_Rect) { xs[i], ys[i], TRAIL, TRAIL };
+    }
+    Uint32 color = SDL_MapRGBA(win->format, 0x22, 0x22, 0x22, 0x20);
+    t0 = Clock::now();
+    for (int i = 0; i < OPS; i += BATCH) {
+        SDL_FillRects(win, &rects[i], BATCH, color);
+    }
+    printf("fill %dx%d  SDL_FillRects    %7.1f ns\n", TRAIL, TRAIL, ns_per_op(t0));
+
+    SDL_FreeSurface(spr);
+    SDL_FreeSurface(win);
+}
+
+static void bench_cairo(uint32_t* sprite_px)
+{
+    cairo_surface_t* win = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, WIN_W, WIN_H);
+    cairo_surface_t* spr = cairo_image_surface_create_for_data((unsigned char*)sprite_px,
+            CAIRO_FORMAT_ARGB32, SPRITE, SPRITE, SPRITE * 4);
+    cairo_t* cr = cairo_create(win);
+
+    random_spots(SPRITE);
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < OPS; i++) {
+        cairo_set_source_surface(cr, spr, xs[i], ys[i]);
+        cairo_rectangle(cr, xs[i], ys[i], SPRITE, SPRITE);
+        cairo_fill(cr);
+    }
+    cairo_surface_flush(win);
+    printf("over %dx%d  cairo OVER       %7.1f ns\n", SPRITE, SPRITE, ns_per_op(t0));
+
+    random_spots(TRAIL);
+    cairo_set_source_rgba(cr, 0x22 / 255.0, 0x22 / 255.0, 0x22 / 255.0, 0x20 / 255.0);
+    t0 = Clock::now();
+    for (int i = 0; i < OPS; i++) {
+        cairo_rectangle(cr, xs[i], ys[i], TRAIL, TRAIL);
+        cairo_fill(cr);
+    }
+    cairo_surface_flush(win);
+    printf("fill %dx%d  cairo OVER       %7.1f ns\n", TRAIL, TRAIL, ns_per_op(t0));
+
+    cairo_destroy(cr);
+    cairo_surface_destroy(spr);
+    cairo_surface_destroy(win);
+}
+
+int main()
+{
+    vector<uint32_t> sprite_px(SPRITE * SPRITE), win(WIN_W * WIN_H, 0xff336699);
+    sprite_pixels(sprite_px.data());
+    Pixmap sprite = pixmap_wrap(sprite_px.data(), SPRITE, SPRITE, SPRITE * 4);
+
+    bench_composite(win, &sprite, composite_rgba(0x22, 0x22, 0x22, 0x20));
+    bench_sdl(sprite_px.data());
+    bench_cairo(sprite_px.data());
+    return 0;
+}
@@ -0,0 +1,304 @@
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+typedef struct {
+    uint32_t* pixels;
+    unsigned int frame;
+} Slot;
+
+static struct {
+    bool active;
+    char dir[256];
+    CaptureFormat fmt;
+    int w, h;
+    int rs, gs, bs; /// channel shifts
+
+    vector<Slot> slots;
+    vector<int> free_slots; /// stack
+    vector<int> queue;      /// ring of submitted slots, capacity == pool
+    int q_head, q_len;
+    bool stopping;
+
+    unsigned int frame; /// render frame counter, bumped per acquire
+    CaptureStats stats;
+
+    mutex lock;
+    condition_variable cond;
+    thread writer;
+} cap;
+
+//
+// encoders, only ever run on the writer thread
+//
+
+static vector<unsigned char> rgb_buf;
+static vector<unsigned char> z_buf;
+
+/// 32bit rows into packed RGB, each row prefixed by filter_byte when >= 0
+/// (png)
+static void pack_rgb(const uint32_t* px, int filter_byte)
+{
+    size_t row = cap.w * 3 + (filter_byte >= 0 ? 1 : 0);
+    rgb_buf.resize(row * cap.h);
+
+    unsigned char* d = rgb_buf.data();
+    int rs = cap.rs, gs = cap.gs, bs = cap.bs;
+    for (int y = 0; y < cap.h; y++) {
+        if (filter_byte >= 0) *d++ = filter_byte;
+        const uint32_t* s = px + y * cap.w;
+        for (int x = 0; x < cap.w; x++) {
+            uint32_t v = s[x];
+            *d++ = v >> rs;
+            *d++ = v >> gs;
+            *d++ = v >> bs;
+        }
+    }
+}
+
+static bool write_ppm(FILE* fp, const uint32_t* px)
+{
+    pack_rgb(px, -1);
+    fprintf(fp, "P6\n%d %d\n255\n", cap.w, cap.h);
+    return fwrite(rgb_buf.data(), 1, rgb_buf.size(), fp) == rgb_buf.size();
+}
+
+static void put_be32(unsigned char* p, uint32_t v)
+{
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static bool write_png_chunk(FILE* fp, const char* type, const unsigned char* data, uint32_t len)
+{
+    unsigned char hdr[8];
+    put_be32(hdr, len);
+    memcpy(hdr + 4, type, 4);
+
+    uLong crc = crc32(0, hdr + 4, 4);
+    if (len) crc = crc32(crc, data, len);
+    unsigned char tail[4];
+    put_be32(tail, crc);
+
+    return fwrite(hdr, 1, 8, fp) == 8 &&
+        (!len || fwrite(data, 1, len, fp) == len) &&
+        fwrite(tail, 1, 4, fp) == 4;
+}
+
+static bool write_png(FILE* fp, const uint32_t* px)
+{
+    static const unsigned char sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+    pack_rgb(px, 0);
+
+    uLongf zlen = compressBound(rgb_buf.size());
+    z_buf.resize(zlen);
+    // level 1: frames are large and the writer has to keep up
+    if (compress2(z_buf.data(), &zlen, rgb_buf.data(), rgb_buf.size(), 1) != Z_OK) {
+        return false;
+    }
+
+    unsigned char ihdr[13];
+    put_be32(ihdr, cap.w);
+    put_be32(ihdr + 4, cap.h);
+    ihdr[8] = 8;  // bit depth
+    ihdr[9] = 2;  // truecolor
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    return fwrite(sig, 1, 8, fp) == 8 &&
+        write_png_chunk(fp, "IHDR", ihdr, sizeof ihdr) &&
+        write_png_chunk(fp, "IDAT", z_buf.data(), zlen) &&
+        write_png_chunk(fp, "IEND", NULL, 0);
+}
+
+static bool write_frame(const Slot& s)
+{
+    char path[300];
+    snprintf(path, sizeof path, "%s/frame-%06u.%s", cap.dir, s.frame,
+            cap.fmt == CAPTURE_PNG ? "png" : "ppm");
+
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        return false;
+    }
+
+    bool ok = cap.fmt == CAPTURE_PNG ? write_png(fp, s.pixels) : write_ppm(fp, s.pixels);
+    return (fclose(fp) == 0) && ok;
+}
+
+static void writer_main()
+{
+    unique_lock<mutex> lk(cap.lock);
+    for (;;) {
+        cap.cond.wait(lk, [] { return cap.q_len > 0 || cap.stopping; });
+        if (cap.q_len == 0) break; // stopping and drained
+
+        int id = cap.queue[cap.q_head];
+        cap.q_head = (cap.q_head + 1) % cap.queue.size();
+        cap.q_len--;
+
+        lk.unlock();
+        bool ok = write_frame(cap.slots[id]);
+        lk.lock();
+
+        if (ok) {
+            cap.stats.written++;
+        } else if (cap.stats.failed++ == 0) {
+            fprintf(stderr, "capture: write frame %u to %s failed\n", cap.slots[id].frame, cap.dir);
+        }
+        cap.free_slots.push_back(id);
+    }
+}
+
+/// shift of a byte aligned 8bit mask, -1 otherwise
+static int mask_shift(uint32_t mask)
+{
+    if (!mask) return -1;
+    int s = __builtin_ctz(mask);
+    return (s % 8 == 0 && mask >> s == 0xff) ? s : -1;
+}
+
+bool capture_start(const char* dir, CaptureFormat fmt, int w, int h, int pool, CaptureMasks masks)
+{
+    if (cap.active || w <= 0 || h <= 0 || pool <= 0) {
+        return false;
+    }
+
+    int rs = mask_shift(masks.r), gs = mask_shift(masks.g), bs = mask_shift(masks.b);
+    if (rs < 0 || gs < 0 || bs < 0) {
+        fprintf(stderr, "capture: pixel layout r %08x g %08x b %08x not supported\n",
+                masks.r, masks.g, masks.b);
+        return false;
+    }
+
+    snprintf(cap.dir, sizeof cap.dir, "%s", dir);
+    cap.fmt = fmt;
+    cap.w = w;
+    cap.h = h;
+    cap.rs = rs, cap.gs = gs, cap.bs = bs;
+
+    cap.slots.resize(pool);
+    cap.free_slots.clear();
+    for (int i = 0; i < pool; i++) {
+        cap.slots[i].pixels = new uint32_t[w * h];
+        cap.free_slots.push_back(i);
+    }
+    cap.queue.assign(pool, 0);
+    cap.q_head = cap.q_len = 0;
+    cap.stopping = false;
+    cap.frame = 0;
+    cap.stats = CaptureStats();
+
+    static bool registered = false;
+    if (!registered) {
+        atexit(capture_stop); // flush and join on error exits too
+        registered = true;
+    }
+
+    cap.writer = thread(writer_main);
+    cap.active = true;
+    return true;
+}
+
+bool capture_start_from_env(int w, int h, CaptureMasks masks)
+{
+    const char* dir = getenv("NAVGUIDE_CAPTURE");
+    if (!dir || !*dir) {
+        return false;
+    }
+
+    CaptureFormat fmt = CAPTURE_PPM;
+    if (const char* f = getenv("NAVGUIDE_CAPTURE_FORMAT")) {
+        if (!strcmp(f, "png")) fmt = CAPTURE_PNG;
+    }
+
+    if (!capture_start(dir, fmt, w, h, 8, masks)) {
+        return false;
+    }
+    fprintf(stderr, "capture: %dx%d %s frames into %s\n", w, h,
+            fmt == CAPTURE_PNG ? "png" : "ppm", dir);
+    return true;
+}
+
+bool capture_active()
+{
+    return cap.active;
+}
+
+uint32_t* capture_acquire()
+{
+    lock_guard<mutex> lk(cap.lock);
+    unsigned int frame = cap.frame++;
+    if (cap.free_slots.empty()) {
+        cap.stats.dropped++;
+        return NULL;
+    }
+
+    int id = cap.free_slots.back();
+    cap.free_slots.pop_back();
+    cap.slots[id].frame = frame;
+    return cap.slots[id].pixels;
+}
+
+void capture_submit(uint32_t* buf)
+{
+    {
+        lock_guard<mutex> lk(cap.lock);
+        int id = 0;
+        while (cap.slots[id].pixels != buf) id++;
+
+        cap.queue[(cap.q_head + cap.q_len) % cap.queue.size()] = id;
+        cap.q_len++;
+        cap.stats.captured++;
+    }
+    cap.cond.notify_one();
+}
+
+void capture_frame(const Pixmap* src)
+{
+    uint32_t* buf = capture_acquire();
+    if (!buf) return;
+
+    int w = src->w < cap.w ? src->w : cap.w;
+    int h = src->h < cap.h ? src->h : cap.h;
+    for (int y = 0; y < h; y++) {
+        memcpy(buf + y * cap.w, src->pixels + y * src->stride, w * 4);
+    }
+    capture_submit(buf);
+}
+
+void capture_stop()
+{
+    if (!cap.active) return;
+
+    {
+        lock_guard<mutex> lk(cap.lock);
+        cap.stopping = true;
+    }
+    cap.cond.notify_one();
+    cap.writer.join();
+
+    for (auto& s : cap.slots) {
+        delete [] s.pixels;
+    }
+    cap.slots.clear();
+    cap.active = false;
+
+    fprintf(stderr, "capture: %u frames, %u written, %u dropped, %u failed\n",
+            cap.frame, cap.stats.written, cap.stats.dropped, cap.stats.failed);
+}
+
+CaptureStats capture_stats()
+{
+    lock_guard<mutex> lk(cap.lock);
+    return cap.stats;
+}
@@ -0,0 +1,58 @@
+#ifndef NAVGUIDE_CAPTURE_H
+#define NAVGUIDE_CAPTURE_H
+
+#include <stdint.h>
+
+#include "composite.h"
+
+/// offscreen frame capture: rendered frames are copied into a fixed pool of
+/// recycled buffers and a writer thread streams them to disk. the render
+/// side never waits on I/O, when every buffer is in flight the frame is
+/// dropped and counted instead.
+
+typedef enum {
+    CAPTURE_PPM = 0, /// raw P6, fastest to write
+    CAPTURE_PNG      /// zlib compressed
+} CaptureFormat;
+
+typedef struct {
+    unsigned int captured; /// handed to the writer
+    unsigned int written;
+    unsigned int dropped;  /// no free buffer at capture time
+    unsigned int failed;   /// write errors
+} CaptureStats;
+
+/// where the 8bit channels sit in a 32bit pixel, as SDL_PixelFormat masks
+typedef struct {
+    uint32_t r, g, b;
+} CaptureMasks;
+
+/// 0xAARRGGBB, what Pixmap, cairo ARGB32 and SDL ARGB8888 use
+static const CaptureMasks CAPTURE_ARGB = { 0x00ff0000, 0x0000ff00, 0x000000ff };
+
+/// frames are written as <dir>/frame-NNNNNN.{ppm,png}, numbered by render
+/// frame so drops show up as gaps. pool bounds the queue depth.
+/// false for masks that are not whole bytes.
+bool capture_start(const char* dir, CaptureFormat fmt, int w, int h, int pool, CaptureMasks masks);
+
+/// reads NAVGUIDE_CAPTURE=<dir> and NAVGUIDE_CAPTURE_FORMAT=ppm|png,
+/// false when capture is not requested or cannot start
+bool capture_start_from_env(int w, int h, CaptureMasks masks);
+
+bool capture_active();
+
+/// get a free w*h buffer for the next frame (stride w), NULL means the
+/// frame is dropped. every non NULL buffer must go back through
+/// capture_submit().
+uint32_t* capture_acquire();
+void capture_submit(uint32_t* buf);
+
+/// acquire + copy + submit, clipped to the capture size
+void capture_frame(const Pixmap* src);
+
+/// drains the queue, joins the writer and reports the counters
+void capture_stop();
+
+CaptureStats capture_stats();
+
+#endif
@@ -0,0 +1,442 @@
+#include "composite.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define HAVE_AVX2_KERNELS 1
+#endif
+#endif
+
+#if defined(__SSE2__)
+#define HAVE_SSE2_KERNELS 1
+#endif
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/// x / 255 rounded, exact for x in [0, 255*255]. every kernel uses the
+/// same formula so all implementations are bit identical.
+static inline uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+//
+// scalar reference, also what non-x86 (Loongson) runs
+//
+
+static inline uint32_t over_pixel(uint32_t s, uint32_t d, uint32_t ia)
+{
+    uint32_t r = 0;
+    for (int sh = 0; sh < 32; sh += 8) {
+        uint32_t c = ((s >> sh) & 0xff) + div255(((d >> sh) & 0xff) * ia);
+        r |= MIN(c, 0xffu) << sh;
+    }
+    return r;
+}
+
+static void over_row_scalar(uint32_t* dst, const uint32_t* src, int n)
+{
+    for (int i = 0; i < n; i++) {
+        uint32_t s = src[i];
+        uint32_t sa = s >> 24;
+        if (sa == 0xff) {
+            dst[i] = s;
+        } else if (s) {
+            dst[i] = over_pixel(s, dst[i], 255 - sa);
+        }
+    }
+}
+
+static void fill_row_scalar(uint32_t* dst, int n, uint32_t color)
+{
+    uint32_t ia = 255 - (color >> 24);
+    for (int i = 0; i < n; i++) {
+        dst[i] = over_pixel(color, dst[i], ia);
+    }
+}
+
+static void copy_row_scalar(uint32_t* dst, const uint32_t* src, int n)
+{
+    for (int i = 0; i < n; i++) {
+        dst[i] = src[i] | 0xff000000;
+    }
+}
+
+//
+// SSE2: 4 pixels per step, channels widened to 16 bits
+//
+
+#ifdef HAVE_SSE2_KERNELS
+static inline __m128i sse2_scale(__m128i d16, __m128i ia16)
+{
+    __m128i t = _mm_mullo_epi16(d16, ia16);
+    t = _mm_add_epi16(t, _mm_set1_epi16(128));
+    t = _mm_add_epi16(t, _mm_srli_epi16(t, 8));
+    return _mm_srli_epi16(t, 8);
+}
+
+static inline __m128i sse2_alpha16(__m128i s16)
+{
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(s16, 0xff), 0xff);
+}
+
+static void over_row_sse2(uint32_t* dst, const uint32_t* src, int n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i amask = _mm_set1_epi32(0xff000000);
+    const __m128i c255 = _mm_set1_epi16(255);
+
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xffff) continue;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, amask), amask)) == 0xffff) {
+            _mm_storeu_si128((__m128i*)(dst + i), s);
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+        __m128i dlo = _mm_unpacklo_epi8(d, zero), dhi = _mm_unpackhi_epi8(d, zero);
+        dlo = sse2_scale(dlo, _mm_sub_epi16(c255, sse2_alpha16(slo)));
+        dhi = sse2_scale(dhi, _mm_sub_epi16(c255, sse2_alpha16(shi)));
+        d = _mm_adds_epu8(_mm_packus_epi16(dlo, dhi), s);
+        _mm_storeu_si128((__m128i*)(dst + i), d);
+    }
+
+    over_row_scalar(dst + i, src + i, n - i);
+}
+
+static void fill_row_sse2(uint32_t* dst, int n, uint32_t color)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c = _mm_set1_epi32(color);
+    const __m128i ia = _mm_set1_epi16(255 - (color >> 24));
+
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i dlo = sse2_scale(_mm_unpacklo_epi8(d, zero), ia);
+        __m128i dhi = sse2_scale(_mm_unpackhi_epi8(d, zero), ia);
+        d = _mm_adds_epu8(_mm_packus_epi16(dlo, dhi), c);
+        _mm_storeu_si128((__m128i*)(dst + i), d);
+    }
+
+    fill_row_scalar(dst + i, n - i, color);
+}
+
+static void copy_row_sse2(uint32_t* dst, const uint32_t* src, int n)
+{
+    const __m128i amask = _mm_set1_epi32(0xff000000);
+
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 12));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(a, amask));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_or_si128(b, amask));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_or_si128(c, amask));
+        _mm_storeu_si128((__m128i*)(dst + i + 12), _mm_or_si128(d, amask));
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(a, amask));
+    }
+
+    copy_row_scalar(dst + i, src + i, n - i);
+}
+#endif
+
+//
+// AVX2: same math as SSE2 on 8 pixels, unpack/pack stay within 128bit lanes
+// so pixel order is preserved. built with a target attribute and only
+// selected when the cpu reports avx2.
+//
+
+#ifdef HAVE_AVX2_KERNELS
+#define AVX2_FN __attribute__((target("avx2")))
+
+AVX2_FN static inline __m256i avx2_scale(__m256i d16, __m256i ia16)
+{
+    __m256i t = _mm256_mullo_epi16(d16, ia16);
+    t = _mm256_add_epi16(t, _mm256_set1_epi16(128));
+    t = _mm256_add_epi16(t, _mm256_srli_epi16(t, 8));
+    return _mm256_srli_epi16(t, 8);
+}
+
+AVX2_FN static inline __m256i avx2_alpha16(__m256i s16)
+{
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s16, 0xff), 0xff);
+}
+
+AVX2_FN static void over_row_avx2(uint32_t* dst, const uint32_t* src, int n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i amask = _mm256_set1_epi32(0xff000000);
+    const __m256i c255 = _mm256_set1_epi16(255);
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        if (_mm256_testz_si256(s, s)) continue;
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, amask), amask)) == -1) {
+            _mm256_storeu_si256((__m256i*)(dst + i), s);
+            continue;
+        }
+
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i slo = _mm256_unpacklo_epi8(s, zero), shi = _mm256_unpackhi_epi8(s, zero);
+        __m256i dlo = _mm256_unpacklo_epi8(d, zero), dhi = _mm256_unpackhi_epi8(d, zero);
+        dlo = avx2_scale(dlo, _mm256_sub_epi16(c255, avx2_alpha16(slo)));
+        dhi = avx2_scale(dhi, _mm256_sub_epi16(c255, avx2_alpha16(shi)));
+        d = _mm256_adds_epu8(_mm256_packus_epi16(dlo, dhi), s);
+        _mm256_storeu_si256((__m256i*)(dst + i), d);
+    }
+
+    over_row_scalar(dst + i, src + i, n - i);
+}
+
+AVX2_FN static void fill_row_avx2(uint32_t* dst, int n, uint32_t color)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c = _mm256_set1_epi32(color);
+    const __m256i ia = _mm256_set1_epi16(255 - (color >> 24));
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i dlo = avx2_scale(_mm256_unpacklo_epi8(d, zero), ia);
+        __m256i dhi = avx2_scale(_mm256_unpackhi_epi8(d, zero), ia);
+        d = _mm256_adds_epu8(_mm256_packus_epi16(dlo, dhi), c);
+        _mm256_storeu_si256((__m256i*)(dst + i), d);
+    }
+
+    fill_row_scalar(dst + i, n - i, color);
+}
+
+AVX2_FN static void copy_row_avx2(uint32_t* dst, const uint32_t* src, int n)
+{
+    const __m256i amask = _mm256_set1_epi32(0xff000000);
+
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 8));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(src + i + 16));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(src + i + 24));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(a, amask));
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_or_si256(b, amask));
+        _mm256_storeu_si256((__m256i*)(dst + i + 16), _mm256_or_si256(c, amask));
+        _mm256_storeu_si256((__m256i*)(dst + i + 24), _mm256_or_si256(d, amask));
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(a, amask));
+    }
+
+    copy_row_scalar(dst + i, src + i, n - i);
+}
+#endif
+
+//
+// dispatch
+//
+
+typedef struct {
+    void (*over_row)(uint32_t*, const uint32_t*, int);
+    void (*fill_row)(uint32_t*, int, uint32_t);
+    void (*copy_row)(uint32_t*, const uint32_t*, int);
+} Kernels;
+
+static Kernels kernels = { over_row_scalar, fill_row_scalar, copy_row_scalar };
+static CompositeImpl current = COMPOSITE_SCALAR;
+
+static CompositeImpl best_supported()
+{
+#ifdef HAVE_AVX2_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return COMPOSITE_AVX2;
+#endif
+#ifdef HAVE_SSE2_KERNELS
+    return COMPOSITE_SSE2;
+#else
+    return COMPOSITE_SCALAR;
+#endif
+}
+
+const char* composite_impl_name(CompositeImpl impl)
+{
+    switch (impl) {
+        case COMPOSITE_AVX2: return "avx2";
+        case COMPOSITE_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+CompositeImpl composite_select(CompositeImpl impl)
+{
+    impl = MIN(impl, best_supported());
+    switch (impl) {
+#ifdef HAVE_AVX2_KERNELS
+        case COMPOSITE_AVX2:
+            kernels = (Kernels) { over_row_avx2, fill_row_avx2, copy_row_avx2 };
+            break;
+#endif
+#ifdef HAVE_SSE2_KERNELS
+        case COMPOSITE_SSE2:
+            kernels = (Kernels) { over_row_sse2, fill_row_sse2, copy_row_sse2 };
+            break;
+#endif
+        default:
+            impl = COMPOSITE_SCALAR;
+            kernels = (Kernels) { over_row_scalar, fill_row_scalar, copy_row_scalar };
+            break;
+    }
+
+    current = impl;
+    return current;
+}
+
+CompositeImpl composite_init()
+{
+    CompositeImpl impl = best_supported();
+    if (const char* env = getenv("NAVGUIDE_COMPOSITE")) {
+        if (!strcmp(env, "scalar")) impl = COMPOSITE_SCALAR;
+        else if (!strcmp(env, "sse2")) impl = COMPOSITE_SSE2;
+        else if (!strcmp(env, "avx2")) impl = COMPOSITE_AVX2;
+    }
+    return composite_select(impl);
+}
+
+void composite_premultiply(Pixmap* p)
+{
+    for (int y = 0; y < p->h; y++) {
+        uint32_t* row = p->pixels + y * p->stride;
+        for (int x = 0; x < p->w; x++) {
+            uint32_t v = row[x], a = v >> 24;
+            if (a == 0xff) continue;
+            row[x] = composite_rgba((v >> 16) & 0xff, (v >> 8) & 0xff, v & 0xff, a);
+        }
+    }
+}
+
+void composite_over(Pixmap* dst, int dx, int dy,
+        const Pixmap* src, int sx, int sy, int w, int h)
+{
+    // clip against src
+    if (sx < 0) { dx -= sx; w += sx; sx = 0; }
+    if (sy < 0) { dy -= sy; h += sy; sy = 0; }
+    w = MIN(w, src->w - sx);
+    h = MIN(h, src->h - sy);
+
+    // and against dst
+    if (dx < 0) { sx -= dx; w += dx; dx = 0; }
+    if (dy < 0) { sy -= dy; h += dy; dy = 0; }
+    w = MIN(w, dst->w - dx);
+    h = MIN(h, dst->h - dy);
+    if (w <= 0 || h <= 0) return;
+
+    uint32_t* d = dst->pixels + dy * dst->stride + dx;
+    const uint32_t* s = src->pixels + sy * src->stride + sx;
+    for (int y = 0; y < h; y++) {
+        kernels.over_row(d, s, w);
+        d += dst->stride;
+        s += src->stride;
+    }
+}
+
+void composite_fill(Pixmap* dst, int x, int y, int w, int h, uint32_t color)
+{
+    int x0 = MAX(x, 0), y0 = MAX(y, 0);
+    int x1 = MIN(x + w, dst->w), y1 = MIN(y + h, dst->h);
+    if (x1 <= x0 || y1 <= y0 || color == 0) return;
+
+    uint32_t* d = dst->pixels + y0 * dst->stride + x0;
+    for (int j = y0; j < y1; j++) {
+        kernels.fill_row(d, x1 - x0, color);
+        d += dst->stride;
+    }
+}
+
+void composite_copy(Pixmap* dst, const Pixmap* src, int sx, int sy)
+{
+    int dx = 0, dy = 0;
+    if (sx < 0) { dx = -sx; sx = 0; }
+    if (sy < 0) { dy = -sy; sy = 0; }
+    dx = MIN(dx, dst->w), dy = MIN(dy, dst->h);
+    int w = MAX(MIN(dst->w - dx, src->w - sx), 0);
+    int h = MAX(MIN(dst->h - dy, src->h - sy), 0);
+
+    // src covers the (dx, dy, w, h) rect, the border around it is cleared
+    for (int y = 0; y < dst->h; y++) {
+        uint32_t* d = dst->pixels + y * dst->stride;
+        if (y < dy || y >= dy + h) {
+            for (int x = 0; x < dst->w; x++) d[x] = 0xff000000;
+            continue;
+        }
+
+        for (int x = 0; x < dx; x++) d[x] = 0xff000000;
+        if (w) kernels.copy_row(d + dx, src->pixels + (sy + y - dy) * src->stride + sx, w);
+        for (int x = dx + w; x < dst->w; x++) d[x] = 0xff000000;
+    }
+}
+
+void composite_copy_scaled(Pixmap* dst, const Pixmap* src, int sx, int sy, uint32_t step)
+{
+    // first and last+1 dst columns that land inside src
+    int64_t fx0 = (int64_t)sx << 16, fy0 = (int64_t)sy << 16;
+    int x0 = fx0 < 0 ? (int)((-fx0 + step - 1) / step) : 0;
+    int x1 = (int)((((int64_t)src->w << 16) - fx0 + step - 1) / step);
+    x0 = MIN(x0, dst->w);
+    x1 = MIN(MAX(x1, x0), dst->w);
+
+    for (int y = 0; y < dst->h; y++) {
+        uint32_t* d = dst->pixels + y * dst->stride;
+        int64_t fy = fy0 + (int64_t)y * step;
+        int row = (int)(fy >> 16);
+        if (fy < 0 || row >= src->h) {
+            for (int x = 0; x < dst->w; x++) d[x] = 0xff000000;
+            continue;
+        }
+
+        const uint32_t* s = src->pixels + row * src->stride;
+        for (int x = 0; x < x0; x++) d[x] = 0xff000000;
+        uint32_t fx = (uint32_t)(fx0 + (int64_t)x0 * step);
+        for (int x = x0; x < x1; x++, fx += step) {
+            d[x] = s[fx >> 16] | 0xff000000;
+        }
+        for (int x = x1; x < dst->w; x++) d[x] = 0xff000000;
+    }
+}
+
+void composite_over_scaled(Pixmap* dst, int dx, int dy, int dw, int dh, const Pixmap* src)
+{
+    if (dw <= 0 || dh <= 0) return;
+    uint32_t stepx = ((uint32_t)src->w << 16) / dw;
+    uint32_t stepy = ((uint32_t)src->h << 16) / dh;
+
+    int x0 = MAX(dx, 0), y0 = MAX(dy, 0);
+    int x1 = MIN(dx + dw, dst->w), y1 = MIN(dy + dh, dst->h);
+    if (x1 <= x0 || y1 <= y0) return;
+
+    for (int y = y0; y < y1; y++) {
+        uint32_t* d = dst->pixels + y * dst->stride;
+        const uint32_t* s = src->pixels + ((uint32_t)(y - dy) * stepy >> 16) * src->stride;
+        uint32_t fx = (uint32_t)(x0 - dx) * stepx;
+        for (int x = x0; x < x1; x++, fx += stepx) {
+            uint32_t v = s[fx >> 16], sa = v >> 24;
+            if (sa == 0xff) {
+                d[x] = v;
+            } else if (v) {
+                d[x] = over_pixel(v, d[x], 255 - sa);
+            }
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef NAVGUIDE_COMPOSITE_H
+#define NAVGUIDE_COMPOSITE_H
+
+#include <stdint.h>
+
+/// 32bpp pixel buffer, alpha in the top byte (0xAARRGGBB in native order).
+/// color channels are premultiplied, which is what cairo ARGB32 uses and
+/// what composite_premultiply() turns an SDL surface into.
+typedef struct {
+    uint32_t* pixels;
+    int w, h;
+    int stride; /// in pixels, not bytes
+} Pixmap;
+
+typedef enum {
+    COMPOSITE_SCALAR = 0,
+    COMPOSITE_SSE2,
+    COMPOSITE_AVX2
+} CompositeImpl;
+
+/// pick the fastest kernels the cpu supports, NAVGUIDE_COMPOSITE=scalar|sse2|avx2
+/// in the environment overrides the detection.
+CompositeImpl composite_init();
+const char* composite_impl_name(CompositeImpl impl);
+
+/// force a given implementation (clamped to what the cpu supports),
+/// returns what actually got selected.
+CompositeImpl composite_select(CompositeImpl impl);
+
+static inline Pixmap pixmap_wrap(void* data, int w, int h, int stride_bytes)
+{
+    Pixmap p = { (uint32_t*)data, w, h, stride_bytes / 4 };
+    return p;
+}
+
+/// premultiplied pixel from straight 8bit components
+static inline uint32_t composite_rgba(int r, int g, int b, int a)
+{
+    r = (r * a + 127) / 255;
+    g = (g * a + 127) / 255;
+    b = (b * a + 127) / 255;
+    return ((uint32_t)a << 24) | ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
+}
+
+/// convert straight alpha pixels into premultiplied in place
+void composite_premultiply(Pixmap* p);
+
+/// premultiplied src OVER dst; (sx, sy, w, h) of src lands on (dx, dy) of dst.
+/// clipped against both pixmaps.
+void composite_over(Pixmap* dst, int dx, int dy,
+        const Pixmap* src, int sx, int sy, int w, int h);
+
+/// blend a premultiplied solid color over the rect, clipped against dst
+void composite_fill(Pixmap* dst, int x, int y, int w, int h, uint32_t color);
+
+/// opaque copy of the src window at (sx, sy) onto the whole dst, alpha
+/// forced to 0xff so RGB24/XRGB sources come out opaque. whatever falls
+/// outside src is cleared to opaque black.
+void composite_copy(Pixmap* dst, const Pixmap* src, int sx, int sy);
+
+/// zoomed variants, nearest neighbour and scalar only. step is src pixels
+/// per dst pixel in 16.16 fixed point.
+
+/// composite_copy() with dst pixel (x, y) taken from src (sx + x*step,
+/// sy + y*step); whatever falls outside src is cleared to opaque black
+void composite_copy_scaled(Pixmap* dst, const Pixmap* src, int sx, int sy, uint32_t step);
+
+/// the whole of src scaled onto the (dx, dy, dw, dh) rect of dst, OVER
+void composite_over_scaled(Pixmap* dst, int dx, int dy, int dw, int dh, const Pixmap* src);
+
+#endif
@@ -0,0 +1,461 @@
+#include "nav.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+typedef enum {
+    FIELD_IDLE = 0,
+    FIELD_QUEUED,
+    FIELD_RUNNING,
+    FIELD_DONE
+} FieldState;
+
+typedef struct {
+    int dest;               /// cell index, -1 for a free slot
+    int refs;
+    unsigned int last_used;
+    bool ready;             /// cur holds a result for dest
+    bool dirty;             /// needs a (re)compute
+    int rx0, ry0, rx1, ry1; /// cells changed since the last dispatch, rx0 > rx1 for none
+    int jx0, jy0, jx1, jy1; /// the ones the queued/running job repairs
+
+    vector<uint8_t> cur;    /// published directions, render thread only
+    vector<uint8_t> back;   /// worker output while queued/running
+    vector<uint8_t> snap;   /// cost grid snapshot the job runs on
+    FieldState state;
+
+    /// worker side, only touched while queued/running or by nav_acquire()
+    /// on an idle field
+    bool built;             /// dist is the last result for dest, on base
+    vector<uint32_t> dist;
+    vector<uint8_t> base;
+} Field;
+
+static struct {
+    int cell;
+    int w, h;   /// map size in pixels
+    int gw, gh; /// grid size in cells
+    vector<uint8_t> cost; /// 0 blocked, else step cost
+
+    Field fields[NAV_MAX_FIELDS];
+    unsigned int clock;
+
+    int jobs[NAV_MAX_FIELDS]; /// ring, a field is queued at most once
+    int j_head, j_len;
+    bool stopping;
+
+    mutex lock;
+    condition_variable cond;
+    thread worker;
+} nav;
+
+static inline int cell_at(int x, int y)
+{
+    if (x < 0 || y < 0 || x >= nav.w || y >= nav.h) return -1;
+    return (y / nav.cell) * nav.gw + x / nav.cell;
+}
+
+//
+// worker: dijkstra from the destination over 4-neighbours, then every cell
+// points at its cheapest neighbour. a cost change only redoes the cells
+// whose distance depends on it.
+//
+
+#define INF 0xffffffffu
+
+static vector<uint64_t> heap;
+static vector<int> touched;  /// cells a repair changed the distance of
+static vector<uint8_t> mark; /// and their flags, all clear between repairs
+static vector<pair<int, uint32_t>> orphans; /// invalidated cells to visit, with their old distance
+
+static inline void neighbours(int c, int nb[4])
+{
+    int cx = c % nav.gw, cy = c / nav.gw;
+    nb[0] = cy > 0 ? c - nav.gw : -1;
+    nb[1] = cy < nav.gh-1 ? c + nav.gw : -1;
+    nb[2] = cx < nav.gw-1 ? c + 1 : -1;
+    nb[3] = cx > 0 ? c - 1 : -1;
+}
+
+static inline void touch(int c)
+{
+    if (!mark[c]) {
+        mark[c] = 1;
+        touched.push_back(c);
+    }
+}
+
+static inline void push(uint32_t* dist, int c, uint32_t d)
+{
+    dist[c] = d;
+    heap.push_back(((uint64_t)d << 32) | c);
+    push_heap(heap.begin(), heap.end(), greater<uint64_t>());
+}
+
+static void relax(const uint8_t* cost, uint32_t* dist, bool track)
+{
+    while (!heap.empty()) {
+        pop_heap(heap.begin(), heap.end(), greater<uint64_t>());
+        uint64_t top = heap.back();
+        heap.pop_back();
+
+        uint32_t d = top >> 32;
+        int c = top & 0xffffffff;
+        if (d != dist[c]) continue; // stale entry
+
+        int nb[4];
+        neighbours(c, nb);
+        for (int k = 0; k < 4; k++) {
+            int m = nb[k];
+            if (m < 0 || !cost[m]) continue;
+            // cost of entering m
+            uint32_t nd = d + cost[m];
+            if (nd < dist[m]) {
+                if (track) touch(m);
+                push(dist, m, nd);
+            }
+        }
+    }
+}
+
+static uint8_t dir_at(int c, int dest, const uint32_t* dist)
+{
+    uint8_t best = NAV_NONE;
+    if (c != dest && dist[c] != INF) {
+        int gw = nav.gw, cx = c % gw, cy = c / gw;
+        uint32_t bd = dist[c];
+        if (cy > 0 && dist[c - gw] < bd) bd = dist[c - gw], best = NAV_UP;
+        if (cy < nav.gh-1 && dist[c + gw] < bd) bd = dist[c + gw], best = NAV_DOWN;
+        if (cx < gw-1 && dist[c + 1] < bd) bd = dist[c + 1], best = NAV_RIGHT;
+        if (cx > 0 && dist[c - 1] < bd) bd = dist[c - 1], best = NAV_LEFT;
+    }
+    return best;
+}
+
+static void build_field(int dest, const uint8_t* cost, uint32_t* dist, uint8_t* dirs)
+{
+    int n = nav.gw * nav.gh;
+    for (int c = 0; c < n; c++) dist[c] = INF;
+    heap.clear();
+
+    if (cost[dest]) push(dist, dest, 0);
+    relax(cost, dist, false);
+
+    for (int c = 0; c < n; c++) {
+        dirs[c] = dir_at(c, dest, dist);
+    }
+}
+
+/// dist and dirs are a result on base, and base and cost differ at most in
+/// cells x0..x1, y0..y1. cells whose shortest path ran through a cell that
+/// got dearer lose their distance, those and the cells that got cheaper are
+/// seeded from their neighbours and dijkstra runs on from there. false when
+/// the destination itself changed, that takes a full build.
+static bool repair_field(int dest, const uint8_t* base, const uint8_t* cost,
+                         uint32_t* dist, uint8_t* dirs, int x0, int y0, int x1, int y1)
+{
+    int gw = nav.gw;
+    if (dest % gw >= x0 && dest % gw <= x1 && dest / gw >= y0 && dest / gw <= y1 &&
+            base[dest] != cost[dest]) {
+        return false;
+    }
+
+    heap.clear();
+    touched.clear();
+    mark.resize(gw * nav.gh);
+
+    // a cell's parents are the neighbours its distance came through
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            int c = y * gw + x;
+            bool dearer = base[c] && (!cost[c] || cost[c] > base[c]);
+            if (!dearer || mark[c] || dist[c] == INF) continue;
+
+            touch(c);
+            orphans.push_back(make_pair(c, dist[c]));
+            dist[c] = INF;
+            while (!orphans.empty()) {
+                int p = orphans.back().first;
+                uint32_t pd = orphans.back().second;
+                orphans.pop_back();
+
+                int nb[4];
+                neighbours(p, nb);
+                for (int k = 0; k < 4; k++) {
+                    int m = nb[k];
+                    if (m < 0 || mark[m] || dist[m] == INF || dist[m] != pd + base[m]) continue;
+                    touch(m);
+                    orphans.push_back(make_pair(m, dist[m]));
+                    dist[m] = INF;
+                }
+            }
+        }
+    }
+
+    // cells that got cheaper may shorten paths, they are seeds too
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            int c = y * gw + x;
+            if (cost[c] && (!base[c] || cost[c] < base[c])) touch(c);
+        }
+    }
+    for (size_t i = 0; i < touched.size(); i++) {
+        int c = touched[i];
+        if (!cost[c]) continue;
+
+        uint32_t best = dist[c];
+        int nb[4];
+        neighbours(c, nb);
+        for (int k = 0; k < 4; k++) {
+            int m = nb[k];
+            if (m >= 0 && dist[m] != INF && dist[m] + cost[c] < best) best = dist[m] + cost[c];
+        }
+        if (best < dist[c]) push(dist, c, best);
+    }
+
+    relax(cost, dist, true);
+
+    // a direction only depends on the distances of the cell and its
+    // neighbours
+    for (size_t i = 0; i < touched.size(); i++) {
+        int c = touched[i];
+        int nb[4];
+        neighbours(c, nb);
+        dirs[c] = dir_at(c, dest, dist);
+        for (int k = 0; k < 4; k++) {
+            if (nb[k] >= 0) dirs[nb[k]] = dir_at(nb[k], dest, dist);
+        }
+    }
+    for (size_t i = 0; i < touched.size(); i++) mark[touched[i]] = 0;
+    return true;
+}
+
+static void worker_main()
+{
+    unique_lock<mutex> lk(nav.lock);
+    for (;;) {
+        nav.cond.wait(lk, [] { return nav.j_len > 0 || nav.stopping; });
+        if (nav.stopping) break;
+
+        int id = nav.jobs[nav.j_head];
+        nav.j_head = (nav.j_head + 1) % NAV_MAX_FIELDS;
+        nav.j_len--;
+
+        Field& f = nav.fields[id];
+        f.state = FIELD_RUNNING;
+        int dest = f.dest;
+
+        lk.unlock();
+        // back is the result before last, a repair patches the published
+        // one, which only nav_poll() replaces and not while we run
+        bool repaired = f.built && f.jx0 <= f.jx1;
+        if (repaired) {
+            memcpy(f.back.data(), f.cur.data(), f.back.size());
+            repaired = repair_field(dest, f.base.data(), f.snap.data(), f.dist.data(),
+                                    f.back.data(), f.jx0, f.jy0, f.jx1, f.jy1);
+        }
+        if (!repaired) {
+            f.dist.resize(f.snap.size());
+            build_field(dest, f.snap.data(), f.dist.data(), f.back.data());
+        }
+        f.base.swap(f.snap);
+        f.built = true;
+        lk.lock();
+
+        f.state = FIELD_DONE;
+    }
+}
+
+//
+// render thread side
+//
+
+void nav_init(const Pixmap* mask, int w, int h, int cell)
+{
+    nav.cell = cell;
+    nav.w = w;
+    nav.h = h;
+    nav.gw = (w + cell - 1) / cell;
+    nav.gh = (h + cell - 1) / cell;
+    nav.cost.assign(nav.gw * nav.gh, 1);
+
+    int blocked = 0;
+    if (mask) {
+        for (int gy = 0; gy < nav.gh; gy++) {
+            for (int gx = 0; gx < nav.gw; gx++) {
+                int x0 = gx * cell, y0 = gy * cell;
+                int x1 = min(x0 + cell, w), y1 = min(y0 + cell, h);
+
+                unsigned int sum = 0, cnt = 0;
+                for (int y = y0; y < y1; y++) {
+                    const uint32_t* row = mask->pixels + (y * mask->h / h) * mask->stride;
+                    for (int x = x0; x < x1; x++) {
+                        uint32_t v = row[x * mask->w / w];
+                        // channel order does not matter for this luma
+                        sum += (((v >> 16) & 0xff) + 2 * ((v >> 8) & 0xff) + (v & 0xff)) / 4;
+                        cnt++;
+                    }
+                }
+
+                unsigned int luma = cnt ? sum / cnt : 255;
+                uint8_t c = luma < 128 ? 0 : 1 + (255 - luma) * 3 / 128;
+                nav.cost[gy * nav.gw + gx] = c;
+                if (!c) blocked++;
+            }
+        }
+    }
+
+    for (int i = 0; i < NAV_MAX_FIELDS; i++) {
+        Field& f = nav.fields[i];
+        f.dest = -1;
+        f.refs = 0;
+        f.ready = f.dirty = f.built = false;
+        f.rx0 = f.ry0 = 0, f.rx1 = f.ry1 = -1;
+        f.state = FIELD_IDLE;
+    }
+    nav.clock = 0;
+    nav.j_head = nav.j_len = 0;
+    nav.stopping = false;
+    nav.worker = thread(worker_main);
+    atexit(nav_shutdown); // a joinable thread must not reach static destruction
+
+    fprintf(stderr, "nav: %dx%d cells of %d, %d blocked\n", nav.gw, nav.gh, cell, blocked);
+}
+
+void nav_shutdown()
+{
+    if (!nav.worker.joinable()) return;
+    {
+        lock_guard<mutex> lk(nav.lock);
+        nav.stopping = true;
+    }
+    nav.cond.notify_one();
+    nav.worker.join();
+}
+
+void nav_set_passable(int x, int y, int w, int h, bool passable)
+{
+    int gx0 = max(x, 0) / nav.cell, gy0 = max(y, 0) / nav.cell;
+    int gx1 = min((x + w - 1) / nav.cell, nav.gw - 1);
+    int gy1 = min((y + h - 1) / nav.cell, nav.gh - 1);
+    for (int gy = gy0; gy <= gy1; gy++) {
+        for (int gx = gx0; gx <= gx1; gx++) {
+            nav.cost[gy * nav.gw + gx] = passable ? 1 : 0;
+        }
+    }
+
+    if (gx0 > gx1 || gy0 > gy1) return;
+    for (auto& f : nav.fields) {
+        if (f.dest < 0) continue;
+        f.dirty = true;
+        if (f.rx0 > f.rx1) {
+            f.rx0 = gx0, f.ry0 = gy0, f.rx1 = gx1, f.ry1 = gy1;
+        } else {
+            f.rx0 = min(f.rx0, gx0), f.ry0 = min(f.ry0, gy0);
+            f.rx1 = max(f.rx1, gx1), f.ry1 = max(f.ry1, gy1);
+        }
+    }
+}
+
+bool nav_passable(int x, int y)
+{
+    int c = cell_at(x, y);
+    return c >= 0 && nav.cost[c] != 0;
+}
+
+int nav_acquire(int x, int y)
+{
+    int dest = cell_at(x, y);
+    if (dest < 0 || !nav.cost[dest]) return -1;
+
+    int slot = -1;
+    {
+        lock_guard<mutex> lk(nav.lock);
+        for (int i = 0; i < NAV_MAX_FIELDS; i++) {
+            Field& f = nav.fields[i];
+            if (f.dest == dest) {
+                f.refs++;
+                f.last_used = ++nav.clock;
+                return i;
+            }
+
+            // free slot first, otherwise the least recently used idle one
+            if (f.refs || f.state != FIELD_IDLE) continue;
+            if (slot < 0 || (nav.fields[slot].dest >= 0 &&
+                    (f.dest < 0 || f.last_used < nav.fields[slot].last_used))) {
+                slot = i;
+            }
+        }
+    }
+    if (slot < 0) return -1;
+
+    Field& f = nav.fields[slot];
+    int n = nav.gw * nav.gh;
+    f.cur.resize(n);
+    f.back.resize(n);
+    f.snap.resize(n);
+    f.dest = dest;
+    f.refs = 1;
+    f.last_used = ++nav.clock;
+    f.ready = f.built = false;
+    f.dirty = true;
+    f.rx0 = f.ry0 = 0, f.rx1 = f.ry1 = -1;
+    return slot;
+}
+
+void nav_release(int field)
+{
+    if (field >= 0) nav.fields[field].refs--;
+}
+
+int nav_dir(int field, int x, int y)
+{
+    const Field& f = nav.fields[field];
+    int c = cell_at(x, y);
+    if (!f.ready || c < 0) return NAV_NONE;
+    return f.cur[c];
+}
+
+bool nav_arrived(int field, int x, int y)
+{
+    return cell_at(x, y) == nav.fields[field].dest;
+}
+
+void nav_poll()
+{
+    bool queued = false;
+    {
+        lock_guard<mutex> lk(nav.lock);
+        for (int i = 0; i < NAV_MAX_FIELDS; i++) {
+            Field& f = nav.fields[i];
+            if (f.state == FIELD_DONE) {
+                f.cur.swap(f.back);
+                f.ready = true;
+                f.state = FIELD_IDLE;
+            }
+
+            // unreferenced fields stay cached but are not refreshed
+            if (f.state == FIELD_IDLE && f.dirty && f.refs > 0) {
+                f.snap = nav.cost;
+                f.dirty = false;
+                f.jx0 = f.rx0, f.jy0 = f.ry0, f.jx1 = f.rx1, f.jy1 = f.ry1;
+                f.rx0 = f.ry0 = 0, f.rx1 = f.ry1 = -1;
+                f.state = FIELD_QUEUED;
+                nav.jobs[(nav.j_head + nav.j_len) % NAV_MAX_FIELDS] = i;
+                nav.j_len++;
+                queued = true;
+            }
+        }
+    }
+
+    if (queued) nav.cond.notify_one();
+}
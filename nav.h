@@ -0,0 +1,49 @@
+#ifndef NAVGUIDE_NAV_H
+#define NAVGUIDE_NAV_H
+
+#include <stdint.h>
+
+#include "composite.h"
+
+/// flow field navigation over the background map.
+///
+/// the map is split into NAV_CELL sized cells with a traversal cost taken
+/// from a passability mask aligned with the background (white free, gray
+/// slower, dark blocked). every destination gets one flow field, a
+/// direction per cell toward it, computed on a worker thread and shared by
+/// all agents heading there, so per agent lookup is a single array read.
+///
+/// all calls are render thread only; the worker never touches published
+/// fields, nav_poll() swaps finished ones in.
+
+#define NAV_CELL 16
+#define NAV_MAX_FIELDS 64
+
+/// directions match the sprite DIR enums, 0 means no move
+enum {
+    NAV_NONE = 0, NAV_UP, NAV_DOWN, NAV_RIGHT, NAV_LEFT
+};
+
+/// map of w*h pixels, mask is scaled onto it. NULL mask is an open map.
+void nav_init(const Pixmap* mask, int w, int h, int cell);
+void nav_shutdown();
+
+/// change passability of a map rect, fields in use get repaired around the
+/// change in the background and keep steering with the old result until then
+void nav_set_passable(int x, int y, int w, int h, bool passable);
+bool nav_passable(int x, int y);
+
+/// shared field toward map point (x, y), -1 if the point is blocked or
+/// every cached field is still referenced. pair with nav_release().
+int nav_acquire(int x, int y);
+void nav_release(int field);
+
+/// next step for an agent at (x, y): NAV_NONE while the field is not ready,
+/// on arrival, or when the destination is unreachable from there
+int nav_dir(int field, int x, int y);
+bool nav_arrived(int field, int x, int y);
+
+/// publish finished fields and dispatch pending ones, once per frame
+void nav_poll();
+
+#endif
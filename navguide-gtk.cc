@@ -12,6 +12,17 @@
 #include <iostream>
 #include <random>
 
+#include "alloc_count.h"
+#include "arena.h"
+#include "behavior.h"
+#include "capture.h"
+#include "composite.h"
+#include "nav.h"
+#include "scene.h"
+#include "snapshot.h"
+#include "views.h"
+#include "wheel.h"
+
 using namespace std;
 
 typedef struct _Sprite Sprite;
@@ -28,10 +39,10 @@ cairo_surface_t* bg = NULL;
 GtkWidget* window = NULL;
 
 int screen_w = 0, screen_h = 0;
-int bg_x = 0, bg_y = 0, bg_w = 0, bg_h = 0;
-std::random_device rd;
-std::uniform_int_distribution<int> dist(10, 800);
-std::uniform_int_distribution<int> dir_dist(1, 4);
+int bg_w = 0, bg_h = 0;
+int sprite_extent = 0; /// largest sprite side
+unsigned int frame_no = 0;
+unsigned int frame_time = 0; /// get_ticks() once per update
 
 static void err_warn(const char* fmt, ...)
 {
@@ -63,96 +74,72 @@ static int get_ticks()
     return ts.tv_nsec / 1000000 + ts.tv_sec * 1000 - start;
 }
 
-typedef enum {
-    Up = 1, Down, Right, Left
-} DIRECTION;
-
-typedef struct {
-    int x, y;
-    int w, h;
-} Rect;
-
-static const int TEX_LEN = 200 * 15 * 4;
+static const int LABEL_W = 200; /// widest label at 15px high
+static const int TEX_LEN = LABEL_W * 15 * 4;
 //static unsigned char tex_slab[NSPAWN*TEX_LEN]; // large enough for all surfaces
 
 struct _Sprite {
-    Rect bound; /// x,y used as postion, w,h used ad bound
-    char* label;
-    Rect traits[5];
-    unsigned int update_time;
-    DIRECTION dir;
+    SpriteState* st; /// scene_state() of the same slot
     cairo_surface_t* surface;
     cairo_surface_t* label_surface;
+    bool labelled; /// label_surface shows st->label, rendered on first sight
     unsigned char tex_slab[TEX_LEN]; // buffer for label_surface
 
-    void (*draw)(Sprite*, cairo_t*);
-    void (*update)(Sprite*);
+    void (*draw)(Sprite*, const View*, Pixmap*);
 };
 
-#define LABEL_LEN 32
 #define MAX_SPRITES 3000
 #define NSPAWN 2000
 Sprite sprite_slab[MAX_SPRITES];
-char label_slab[MAX_SPRITES*LABEL_LEN];
-int sprite_sp = 0;
+int labels_pending = 0; /// sprites not labelled yet
 
 ostream& operator<<(ostream& os, const Rect& r)
 {
     return os << "{" << r.x << ", " << r.y << ", " << r.w << ", " << r.h << "}";
 }
 
-static void sprite_draw(Sprite* s, cairo_t* cr)
-{
-    Rect r = {
-        0, 0, s->bound.w, s->bound.h
-    };
+static const uint32_t trail_color = composite_rgba(0xe2, 0x22, 0x22, 0x80);
 
-    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-    cairo_set_source_surface(cr, s->surface, s->bound.x, s->bound.y);
-    cairo_rectangle(cr, s->bound.x, s->bound.y, s->bound.w, s->bound.h);
-    cairo_fill(cr);
-
-    cairo_set_source_surface(cr, s->label_surface, s->bound.x+s->bound.w, s->bound.y);
-    cairo_paint(cr);
-
-    auto& x = s->traits;
-    int i = 0;
-    Rect rects[5];
-    for (i = 0; i < 5; i++) {
-        if (x[i].w == 0) break;
-        rects[i].w = rects[i].h = 10;
-        rects[i].x = x[i].x + (x[i].w - 10)/2;
-        rects[i].y = x[i].y + (x[i].h - 10)/2;
-        cairo_set_source_rgba(cr, 0xe2, 0x22, 0x22, 0x80);
-        cairo_rectangle(cr, rects[i].x, rects[i].y, rects[i].w, rects[i].h);
-        cairo_fill(cr);
-    }
+/// image surfaces only, caller flushes/marks dirty around direct access
+static Pixmap surface_pixmap(cairo_surface_t* surf)
+{
+    return pixmap_wrap(cairo_image_surface_get_data(surf),
+            cairo_image_surface_get_width(surf),
+            cairo_image_surface_get_height(surf),
+            cairo_image_surface_get_stride(surf));
+}
 
-    memmove(&s->traits[1], &s->traits, sizeof(s->traits[0])*4);
-    s->traits[0] = s->bound;
+/// map rect to pixels from the top left of v
+static Rect view_rect(const View* v, const Rect& r)
+{
+    int x0 = view_lx(v, r.x), y0 = view_ly(v, r.y);
+    return (Rect) { x0, y0, view_lx(v, r.x + r.w) - x0, view_ly(v, r.y + r.h) - y0 };
 }
 
-static void sprite_update(Sprite* s)
+/// dst is the view's part of the window, may run on a render worker
+static void sprite_draw(Sprite* s, const View* v, Pixmap* dst)
 {
-    if (get_ticks() > s->update_time) {
-        s->dir = (DIRECTION)dir_dist(rd);
-        s->update_time = get_ticks() + 5000;
+    // sprites live in map coordinates
+    Rect pos = view_rect(v, s->st->bound);
+
+    Pixmap src = surface_pixmap(s->surface);
+    if (v->zoom == 1) {
+        composite_over(dst, pos.x, pos.y, &src, 0, 0, s->st->bound.w, s->st->bound.h);
+    } else {
+        composite_over_scaled(dst, pos.x, pos.y, pos.w, pos.h, &src);
     }
 
-    int step = 8;
-    switch(s->dir) {
-        case Up:
-            s->bound.y -= step; break;
-        case Down:
-            s->bound.y += step; break;
-        case Left:
-            s->bound.x -= step; break;
-        default: // right
-            s->bound.x += step; break;
+    // labels keep their size, and would only clutter zoomed out views
+    if (s->label_surface && v->zoom >= 1) {
+        Pixmap label = surface_pixmap(s->label_surface);
+        composite_over(dst, pos.x + pos.w, pos.y, &label, 0, 0, label.w, label.h);
     }
 
-    s->bound.x = min(max(s->bound.x, 0), screen_w);
-    s->bound.y = min(max(s->bound.y, 0), screen_h);
+    auto& x = s->st->traits;
+    for (int i = 0; i < SCENE_TRAIL && x[i].w; i++) {
+        Rect r = view_rect(v, x[i]);
+        composite_fill(dst, r.x, r.y, r.w, r.h, trail_color);
+    }
 }
 
 static void load_text(Sprite* s, const char* text)
@@ -170,55 +157,63 @@ static void load_text(Sprite* s, const char* text)
         atlas_w += (slot->advance.x >> 6);
     }
 
-    int x = 0, y = atlas_h;
-    unsigned char* label_buf = &s->tex_slab[0];
-    s->label_surface = cairo_image_surface_create_for_data(label_buf,
-            CAIRO_FORMAT_ARGB32, atlas_w, atlas_h, atlas_w * 4);
+    // the label has to fit the sprite's slab
+    if (atlas_h > 0 && atlas_w * atlas_h * 4 > TEX_LEN) {
+        atlas_w = TEX_LEN / (atlas_h * 4);
+    }
+
+    // relabelling the same size reuses the surface over tex_slab
+    if (s->label_surface && (cairo_image_surface_get_width(s->label_surface) != atlas_w ||
+                cairo_image_surface_get_height(s->label_surface) != atlas_h)) {
+        cairo_surface_destroy(s->label_surface);
+        s->label_surface = NULL;
+    }
+    if (!s->label_surface) {
+        s->label_surface = cairo_image_surface_create_for_data(&s->tex_slab[0],
+                CAIRO_FORMAT_ARGB32, atlas_w, atlas_h, atlas_w * 4);
+    }
     //cerr << __func__ << "atlas " << atlas_w << "," << atlas_h << endl;
 
-    cairo_t* cr = cairo_create(s->label_surface);
+    cairo_surface_flush(s->label_surface);
+    uint32_t* label_px = (uint32_t*)&s->tex_slab[0];
+    memset(label_px, 0, atlas_w * atlas_h * 4);
 
+    int x = 0, y = atlas_h;
     for (int i = 0, n = strlen(text); i < n; i++) {
         if (FT_Load_Char(face, text[i], FT_LOAD_RENDER)) {
             std::cerr << "load " << text[i] << " failed\n";
-            return;
+            break;
         }
 
+        // glyph coverage straight into the label: premultiplied black at
+        // 0xc0 wherever the glyph has ink
         auto& bm = slot->bitmap;
-        //little-endian
-        unsigned char* buf = new unsigned char[bm.width*bm.rows*4];
-        for (int i = 0, n = bm.width*bm.rows; i < n; i++) {
-            buf[i*4] = 0;
-            buf[i*4+1] = buf[i*4+2] = buf[i*4];
-            buf[i*4+3] = bm.buffer[i] > 0 ? 0xc0: 0;
-        }
-        
-        cairo_surface_t* surf = cairo_image_surface_create_for_data(buf,
-                CAIRO_FORMAT_ARGB32, bm.width, bm.rows, bm.width*4);
-        if (cairo_surface_status(surf) != CAIRO_STATUS_SUCCESS) {
-            cerr << "create glyph surface failed: " << cairo_status_to_string(cairo_surface_status(surf)) << endl;
+        int gx = x + slot->bitmap_left, gy = y - slot->bitmap_top;
+        for (int r = 0; r < (int)bm.rows; r++) {
+            int py = gy + r;
+            if (py < 0 || py >= atlas_h) continue;
+            const unsigned char* src = bm.buffer + r * bm.pitch;
+            for (int c = 0; c < (int)bm.width; c++) {
+                int px = gx + c;
+                if (px < 0 || px >= atlas_w) continue;
+                label_px[py * atlas_w + px] = src[c] ? 0xc0000000 : 0;
+            }
         }
-        cairo_set_source_surface(cr, surf, x + slot->bitmap_left, y - slot->bitmap_top );
-        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-        cairo_rectangle(cr, x + slot->bitmap_left, y - slot->bitmap_top, bm.width, bm.rows);
-        cairo_fill(cr);
-
-        cairo_surface_destroy(surf);
-        delete buf;
 
         x += (slot->advance.x >> 6);
     }
-    cairo_destroy(cr);
-    cairo_surface_flush(s->label_surface);
+    cairo_surface_mark_dirty(s->label_surface);
 }
 
-Sprite* load_sprite(const char* file)
+/// image and drawing for scene slot id, its bound sized to the image. the
+/// label renders when the sprite first shows.
+static Sprite* new_sprite(const char* file, int id)
 {
     static int tw = 0, th = 0;
     static cairo_surface_t* surf = NULL;
 
-    char* label = &label_slab[sprite_sp*LABEL_LEN];
-    Sprite* res = &sprite_slab[sprite_sp];
+    Sprite* res = &sprite_slab[id];
+    res->st = scene_state(id);
 
     if (!surf) {
         GdkPixbuf* pix = gdk_pixbuf_new_from_file(file, NULL);
@@ -229,28 +224,63 @@ Sprite* load_sprite(const char* file)
         }
         tw = cairo_image_surface_get_width(surf),
         th = cairo_image_surface_get_height(surf);
+        sprite_extent = max(sprite_extent, max(tw, th));
     }
 
     res->surface = surf;
 
-    res->bound = (Rect) { dist(rd), dist(rd), tw, th };
+    res->st->bound.w = tw, res->st->bound.h = th;
     res->draw = sprite_draw;
-    res->update = sprite_update;
-    res->update_time = get_ticks();
-    res->label = label;
-    snprintf(label, LABEL_LEN-1, "monkey #%d", sprite_sp);
-    load_text(res, res->label);
+    res->labelled = false;
+    labels_pending++;
+
+    return res;
+}
+
+Sprite* load_sprite(const char* file)
+{
+    int id = scene_add();
+    if (id < 0) return NULL;
+
+    Sprite* res = new_sprite(file, id);
+    scene_spawn(id);
+    snprintf(res->st->label, SNAP_LABEL_LEN-1, "monkey #%d", id);
 
-    sprite_sp++;
     return res;
 }
 
 static void update()
 {
-    for (int i = 0; i < sprite_sp; i++) {
-        sprite_slab[i].update(&sprite_slab[i]);
+    wheel_advance(frame_time);
+    behavior_run(frame_time);
+    nav_poll();
+    scene_update();
+
+    // bucket everyone once, every view culls against the same grid
+    int n = scene_count();
+    int* xy = frame_alloc_array<int>(n * 2);
+    for (int i = 0; i < n; i++) {
+        const Rect& b = sprite_slab[i].st->bound;
+        xy[2*i] = b.x + b.w/2, xy[2*i + 1] = b.y + b.h/2;
     }
+    views_index(xy, n);
+}
 
+/// optional passability mask aligned with the background, open map without
+static void load_navmap()
+{
+    GdkPixbuf* pix = gdk_pixbuf_new_from_file("background-mask.png", NULL);
+    if (!pix) {
+        err_warn("no navigation mask, map is all passable\n");
+        nav_init(NULL, bg_w, bg_h, NAV_CELL);
+    } else {
+        cairo_surface_t* m = gdk_cairo_surface_create_from_pixbuf(pix, 0, NULL);
+        g_object_unref(pix);
+        cairo_surface_flush(m);
+        Pixmap p = surface_pixmap(m);
+        nav_init(&p, bg_w, bg_h, NAV_CELL);
+        cairo_surface_destroy(m);
+    }
 }
 
 static void spawn_sprites(int n)
@@ -259,7 +289,7 @@ static void spawn_sprites(int n)
         load_sprite("sprite.png");
     }
 
-    std::cerr << "spawn sprites done" << sprite_sp << std::endl;
+    std::cerr << "spawn sprites done" << scene_count() << std::endl;
 }
 
 static gboolean drag = FALSE;
@@ -285,23 +315,51 @@ static gboolean on_mouse_motion(GtkWidget* widget, GdkEvent* ev, gpointer data)
         x = ev->motion.x, y = ev->motion.y;
         //gdk_device_get_position(mouse, NULL, &x, &y);
 
-        int w = screen_w, h = screen_h;
-        if (x < 100) {
-            bg_x = max(bg_x-step, 0);
-        } else if (x > w-100) {
-            bg_x = min(bg_x+step, bg_w - w);
+        // edge scrolling for the view under the pointer
+        int i = view_at(x, y);
+        if (i < 0) return FALSE;
+        View* v = view_get(i);
+        int dx = 0, dy = 0;
+        if (x < v->x + 100) {
+            dx = -step;
+        } else if (x > v->x + v->w - 100) {
+            dx = step;
         }
 
-        if (y < 100) {
-            bg_y = max(bg_y-step, 0);
-        } else if (y > h-100) {
-            bg_y = min(bg_y+step, bg_h - h);
+        if (y < v->y + 100) {
+            dy = -step;
+        } else if (y > v->y + v->h - 100) {
+            dy = step;
         }
-        
+        if (dx || dy) view_scroll(v, dx, dy);
     //}
     return FALSE;
 }
 
+static gboolean on_scroll(GtkWidget* widget, GdkEvent* ev, gpointer data)
+{
+    auto& e = ev->scroll;
+    int i = view_at(e.x, e.y);
+    if (i < 0) return FALSE;
+
+    // touchpads send smooth deltas a fraction of a notch at a time, zoom a
+    // step per whole notch they add up to
+    static double smooth = 0;
+    int steps = 0;
+    if (e.direction == GDK_SCROLL_UP) {
+        steps = -1;
+    } else if (e.direction == GDK_SCROLL_DOWN) {
+        steps = 1;
+    } else if (e.direction == GDK_SCROLL_SMOOTH) {
+        smooth += e.delta_y;
+        steps = (int)smooth; // toward zero, the rest carries over
+        smooth -= steps;
+    }
+    for (; steps < 0; steps++) view_zoom(view_get(i), 2.0f, e.x, e.y);
+    for (; steps > 0; steps--) view_zoom(view_get(i), 0.5f, e.x, e.y);
+    return TRUE;
+}
+
 static gboolean on_configure(GtkWidget* widget, GdkEvent* ev, gpointer data)
 {
     //GdkWindow* dw = gtk_widget_get_window(widget);
@@ -321,6 +379,7 @@ static gboolean on_key_press(GtkWidget* widget, GdkEvent* ev, gpointer data)
 static gboolean on_timeout(gpointer data)
 {
     unsigned int cur = get_ticks();
+    frame_time = cur;
     // this slow on Loongson, why?
     //{
         //int step = 10;
@@ -340,7 +399,11 @@ static gboolean on_timeout(gpointer data)
             //bg_y = min(bg_y+step, bg_h - h);
         //}
     //}
+    unsigned long allocs = alloc_count();
     update();
+    alloc_check_frame("update", frame_no, allocs);
+    // views_index() copied the centers, nothing in the arena outlives update
+    frame_reset();
     gtk_widget_queue_draw(window);
     auto ellapsed = get_ticks() - cur;
     g_timeout_add(500-ellapsed, on_timeout, NULL);
@@ -348,31 +411,67 @@ static gboolean on_timeout(gpointer data)
     return G_SOURCE_REMOVE;
 }
 
+/// one view of the shared scene, on a render worker
+static void draw_view(const View* v, const int* ids, int n, void* ctx)
+{
+    Pixmap dst = view_pixmap(v, (const Pixmap*)ctx);
+    Pixmap bg_pix = surface_pixmap(bg);
+    if (v->zoom == 1) {
+        composite_copy(&dst, &bg_pix, v->map_x, v->map_y);
+    } else {
+        composite_copy_scaled(&dst, &bg_pix, v->map_x, v->map_y, view_step(v));
+    }
+
+    for (int k = 0; k < n; k++) {
+        sprite_slab[ids[k]].draw(&sprite_slab[ids[k]], v, &dst);
+    }
+}
+
+/// render the labels of a view's sprites that have none yet, FreeType is
+/// not thread safe so this runs on the gtk thread ahead of drawing
+static void label_view(const View* v, const int* ids, int n, void* ctx)
+{
+    if (v->zoom < 1) return; // not drawn there
+
+    for (int k = 0; k < n; k++) {
+        Sprite* s = &sprite_slab[ids[k]];
+        if (s->labelled) continue;
+        load_text(s, s->st->label);
+        s->labelled = true;
+        labels_pending--;
+    }
+}
+
 static gboolean draw_callback(GtkWidget *widget, cairo_t *cr, gpointer data)
 {
     cerr << __func__ << ": " << get_ticks() << endl;
 
-    Rect r = { bg_x, bg_y, screen_w, screen_h };
-
+    // scratch surface and its pattern live for the whole run
     static cairo_surface_t* tmp = NULL;
+    static cairo_pattern_t* tmp_pattern = NULL;
     if (!tmp) {
         tmp = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, screen_w, screen_h);
+        tmp_pattern = cairo_pattern_create_for_surface(tmp);
     }
 
-    cairo_t* cr2 = cairo_create(tmp);
-
-    cairo_set_operator(cr2, CAIRO_OPERATOR_SOURCE);
-    cairo_set_source_surface(cr2, bg, 0 - bg_x, 0 - bg_y);
-    cairo_rectangle(cr2, 0, 0, screen_w, screen_h);
-    cairo_fill(cr2);
-
-    for (int i = 0; i < sprite_sp; i++) {
-        sprite_slab[i].draw(&sprite_slab[i], cr2);
+    unsigned long allocs = alloc_count();
+    if (labels_pending) {
+        // once per sprite, not a per frame allocation
+        views_render(label_view, NULL, sprite_extent + LABEL_W, false);
+        allocs = alloc_count();
     }
     cairo_surface_flush(tmp);
-    cairo_destroy(cr2);
+    Pixmap dst = surface_pixmap(tmp);
+    // sprites are indexed by center, the margin covers their size, trail
+    // and label
+    views_render(draw_view, &dst, sprite_extent + LABEL_W, true);
+    if (capture_active()) {
+        capture_frame(&dst);
+    }
+    cairo_surface_mark_dirty(tmp);
+    alloc_check_frame(__func__, frame_no++, allocs);
 
-    cairo_set_source_surface(cr, tmp, 0, 0);
+    cairo_set_source(cr, tmp_pattern);
     cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
     cairo_paint(cr);
 
@@ -420,6 +519,7 @@ int main(int argc, char *argv[])
 
     init_ft();
     load_background();
+    cerr << "composite: " << composite_impl_name(composite_init()) << endl;
 
     GdkDevice *device;
     GdkDeviceManager* dev_manager = gdk_display_get_device_manager(
@@ -438,8 +538,30 @@ int main(int argc, char *argv[])
     }
 
     memset(sprite_slab, 0, sizeof sprite_slab);
-    memset(label_slab, 0, sizeof label_slab);
-    spawn_sprites(NSPAWN);
+    views_init(screen_w, screen_h, bg_w, bg_h, MAX_SPRITES);
+    load_navmap();
+    // one behaviour timer per sprite plus the snapshot timer
+    wheel_init(get_ticks(), MAX_SPRITES + 1);
+    behavior_init(get_ticks(), MAX_SPRITES);
+    scene_init(MAX_SPRITES, bg_w, bg_h);
+
+    const char* snap_path = getenv("NAVGUIDE_SNAPSHOT");
+    unsigned int now = get_ticks();
+    int restored = snap_path ? scene_restore(snap_path) : -1;
+    if (restored >= 0) {
+        for (int i = 0; i < restored; i++) {
+            new_sprite("sprite.png", i);
+        }
+        cerr << "restored " << restored << " sprites from " << snap_path << " in "
+            << get_ticks() - now << "ms" << endl;
+    } else {
+        spawn_sprites(NSPAWN);
+        scene_place_dests(sprite_extent);
+    }
+    if (snap_path) {
+        snapshot_start(snap_path, MAX_SPRITES);
+        wheel_add(get_ticks() + SNAPSHOT_PERIOD, scene_save, 0);
+    }
     
     window = gtk_drawing_area_new();
     g_object_connect(window,
@@ -448,6 +570,7 @@ int main(int argc, char *argv[])
             "signal::destroy", gtk_main_quit, NULL,
             "signal::configure-event", on_configure, NULL,
             "signal::motion-notify-event", on_mouse_motion, NULL,
+            "signal::scroll-event", on_scroll, NULL,
             NULL);
 
     gtk_container_add(GTK_CONTAINER(top), window);
@@ -460,7 +583,17 @@ int main(int argc, char *argv[])
 
     gdk_window_set_events(gtk_widget_get_window(window), GDK_ALL_EVENTS_MASK);
     g_timeout_add(500, on_timeout, NULL);
+    capture_start_from_env(screen_w, screen_h, CAPTURE_ARGB);
 
     gtk_main();
+    if (snap_path) {
+        scene_save(-1, get_ticks());
+        snapshot_stop();
+    }
+    behavior_shutdown();
+    scene_shutdown();
+    views_shutdown();
+    capture_stop();
+    nav_shutdown();
     return 0;
 }
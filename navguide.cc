@@ -7,6 +7,17 @@
 #include <iostream>
 #include <random>
 
+#include "alloc_count.h"
+#include "arena.h"
+#include "behavior.h"
+#include "capture.h"
+#include "composite.h"
+#include "nav.h"
+#include "scene.h"
+#include "snapshot.h"
+#include "views.h"
+#include "wheel.h"
+
 //#define USE_OPENGL 1
 
 using namespace std;
@@ -21,13 +32,18 @@ SDL_Renderer* renderer = NULL;
 SDL_Texture* bg_tex = NULL;
 
 int screen_w = 0, screen_h = 0;
-int bg_x = 0, bg_y = 0;
-std::random_device rd;
-std::uniform_int_distribution<int> dist(0, 800);
-std::uniform_int_distribution<int> dir_dist(1, 4);
+int bg_w = 0, bg_h = 0;
+int sprite_extent = 0; /// largest sprite side
+
+/// software path blends with our own kernels when the window surface is
+/// 32bpp with alpha (or nothing) in the top byte, SDL blitters otherwise
+bool use_composite = false;
+Pixmap screen_pix;
+const uint32_t trail_color = composite_rgba(0x22, 0x22, 0x22, 0x20);
 
-unsigned int current_time = 0;
+unsigned int current_time = 0; /// frame clock, read once per loop
 unsigned int refresh_time = 0;
+unsigned int frame_no = 0;
 
 
 static void err_warn(const char* fmt, ...)
@@ -47,103 +63,186 @@ static void err_quit(const char* fmt, ...)
     exit(1);
 }
 
-typedef enum {
-    Up = 1, Down, Right, Left
-} DIR;
-
 struct _Sprite {
-    SDL_Rect bound; /// x,y used as postion, w,h used ad bound
+    SpriteState* st; /// scene_state() of the same slot
 #ifdef USE_OPENGL
     SDL_Texture* tex;
 #else
     SDL_Surface* surface;
 #endif
-    const char* label;
-    SDL_Rect traits[5];
-    unsigned int update_time;
-    DIR dir;
 
-    void (*draw)(Sprite*);
-    void (*update)(Sprite*);
+    void (*draw)(Sprite*, const View*, Pixmap*);
 };
 
 #define MAX_SPRITES 4096
 #define NSPAWN 2000
 Sprite sprite_slab[MAX_SPRITES];
-int sprite_sp = 0;
 
 ostream& operator<<(ostream& os, const SDL_Rect& r)
 {
     return os << "{" << r.x << ", " << r.y << ", " << r.w << ", " << r.h << "}";
 }
 
-static void sprite_draw(Sprite* s)
+static Pixmap surface_pixmap(SDL_Surface* s)
+{
+    return pixmap_wrap(s->pixels, s->w, s->h, s->pitch);
+}
+
+/// window surface is something our ARGB kernels can write directly
+static bool composite_compatible(SDL_PixelFormat* fmt)
 {
-    SDL_Rect r = {
-        0, 0, s->bound.w, s->bound.h
-    };
+    return fmt->BytesPerPixel == 4 && (fmt->Amask == 0 || fmt->Amask == 0xff000000) &&
+        (fmt->Rmask | fmt->Gmask | fmt->Bmask) == 0x00ffffff;
+}
 
-    auto& x = s->traits;
-    int i = 0;
-    SDL_Rect rects[5];
-    for (i = 0; i < 5; i++) {
-        if (x[i].w == 0) break;
-        rects[i].w = rects[i].h = 10;
-        rects[i].x = x[i].x + (x[i].w - 10)/2;
-        rects[i].y = x[i].y + (x[i].h - 10)/2;
-        //cerr << rects[i] << endl;
+/// convert to the window channel order with alpha on top, premultiplied if
+/// it carries alpha
+static SDL_Surface* convert_for_composite(SDL_Surface* src, bool premultiply)
+{
+    SDL_PixelFormat* fmt = surface->format;
+    Uint32 f = SDL_MasksToPixelFormatEnum(32, fmt->Rmask, fmt->Gmask, fmt->Bmask, 0xff000000);
+    SDL_Surface* res = SDL_ConvertSurfaceFormat(src, f, 0);
+    if (!res) {
+        err_quit("convert surface failed: %s\n", SDL_GetError());
     }
+    SDL_FreeSurface(src);
 
-#ifdef USE_OPENGL
-    SDL_RenderCopy(renderer, s->tex, &r, &s->bound);
-    if (i) {
-        SDL_RenderFillRects(renderer, rects, i);
+    if (premultiply) {
+        Pixmap p = surface_pixmap(res);
+        composite_premultiply(&p);
     }
+    return res;
+}
 
+/// map rect to pixels from the top left of v
+static SDL_Rect view_rect(const View* v, const Rect& r)
+{
+    int x0 = view_lx(v, r.x), y0 = view_ly(v, r.y);
+    return (SDL_Rect) { x0, y0, view_lx(v, r.x + r.w) - x0, view_ly(v, r.y + r.h) - y0 };
+}
+
+/// dst is the view's part of the window on the composite path, NULL when
+/// drawing through SDL
+static void sprite_draw(Sprite* s, const View* v, Pixmap* dst)
+{
+    // sprites live in map coordinates
+    SDL_Rect pos = view_rect(v, s->st->bound);
+
+#ifdef USE_OPENGL
+    SDL_RenderCopy(renderer, s->tex, NULL, &pos);
 #else
-    SDL_BlitSurface(s->surface, &r, surface, &s->bound);
-    if (i) {
-        SDL_FillRects(surface, rects, i, SDL_MapRGBA(surface->format, 0x22, 0x22, 0x22, 0x20));
+    if (dst) {
+        Pixmap src = surface_pixmap(s->surface);
+        if (v->zoom == 1) {
+            composite_over(dst, pos.x, pos.y, &src, 0, 0, src.w, src.h);
+        } else {
+            composite_over_scaled(dst, pos.x, pos.y, pos.w, pos.h, &src);
+        }
+    } else {
+        pos.x += v->x, pos.y += v->y;
+        SDL_BlitScaled(s->surface, NULL, surface, &pos);
     }
 #endif
-
-    memmove(&s->traits[1], &s->traits, sizeof(s->traits[0])*4);
-    s->traits[0] = s->bound;
 }
 
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
-
-static void sprite_update(Sprite* s)
+/// trails of the visible sprites, drawn under the sprites
+static void draw_trails(const View* v, const int* ids, int n, Pixmap* dst)
 {
-    if (SDL_TICKS_PASSED(SDL_GetTicks(), s->update_time)) {
-        s->dir = (DIR)dir_dist(rd);
-        s->update_time = SDL_GetTicks() + 5000;
+    if (dst) {
+        // on a render worker, fill straight away rather than batch in the
+        // arena, which is render thread only
+        for (int k = 0; k < n; k++) {
+            auto& x = sprite_slab[ids[k]].st->traits;
+            for (int j = 0; j < SCENE_TRAIL && x[j].w; j++) {
+                SDL_Rect r = view_rect(v, x[j]);
+                composite_fill(dst, r.x, r.y, r.w, r.h, trail_color);
+            }
+        }
+        return;
     }
 
-    int step = 8;
-    switch(s->dir) {
-        case Up:
-            s->bound.y -= step; break;
-        case Down:
-            s->bound.y += step; break;
-        case Left:
-            s->bound.x -= step; break;
-        default: // right
-            s->bound.x += step; break;
+    SDL_Rect* rects = frame_alloc_array<SDL_Rect>(n * SCENE_TRAIL);
+    int m = 0;
+    for (int k = 0; k < n; k++) {
+        auto& x = sprite_slab[ids[k]].st->traits;
+        for (int j = 0; j < SCENE_TRAIL && x[j].w; j++) {
+            rects[m++] = view_rect(v, x[j]);
+        }
     }
+    if (!m) return;
 
-    s->bound.x = MIN(MAX(s->bound.x, 0), screen_w);
-    s->bound.y = MIN(MAX(s->bound.y, 0), screen_h);
+#ifdef USE_OPENGL
+    SDL_RenderFillRects(renderer, rects, m);
+#else
+    for (int i = 0; i < m; i++) {
+        rects[i].x += v->x, rects[i].y += v->y;
+    }
+    SDL_FillRects(surface, rects, m, SDL_MapRGBA(surface->format, 0x22, 0x22, 0x22, 0x20));
+#endif
 }
 
-Sprite* load_sprite(const char* file)
+/// one view of the shared scene. on the composite path this runs on the
+/// render workers, SDL drawing stays on the render thread.
+static void draw_view(const View* v, const int* ids, int n, void* ctx)
+{
+    int mx, my, mw, mh;
+    view_map_rect(v, &mx, &my, &mw, &mh);
+    SDL_Rect src = { mx, my, mw, mh };
+    SDL_Rect dst = view_rect(v, (Rect) { mx, my, mw, mh });
+    SDL_Rect vr = { v->x, v->y, v->w, v->h };
+    bool uncovered = dst.x > 0 || dst.y > 0 || dst.w < v->w || dst.h < v->h;
+
+#ifdef USE_OPENGL
+    SDL_RenderSetViewport(renderer, &vr);
+    if (uncovered) {
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0xff);
+        SDL_RenderFillRect(renderer, NULL);
+        SDL_SetRenderDrawColor(renderer, 0xee, 0xee, 0x0, 0x80);
+    }
+    SDL_RenderCopy(renderer, bg_tex, &src, &dst);
+    draw_trails(v, ids, n, NULL);
+    for (int k = 0; k < n; k++) {
+        sprite_slab[ids[k]].draw(&sprite_slab[ids[k]], v, NULL);
+    }
+#else
+    Pixmap pix, *p = NULL;
+    if (use_composite) {
+        pix = view_pixmap(v, &screen_pix);
+        p = &pix;
+        Pixmap bg_pix = surface_pixmap(bg);
+        if (v->zoom == 1) {
+            composite_copy(p, &bg_pix, v->map_x, v->map_y);
+        } else {
+            composite_copy_scaled(p, &bg_pix, v->map_x, v->map_y, view_step(v));
+        }
+    } else {
+        SDL_SetClipRect(surface, &vr);
+        if (uncovered) {
+            SDL_FillRect(surface, &vr, SDL_MapRGB(surface->format, 0, 0, 0));
+        }
+        dst.x += v->x, dst.y += v->y;
+        SDL_BlitScaled(bg, &src, surface, &dst);
+    }
+
+    draw_trails(v, ids, n, p);
+    for (int k = 0; k < n; k++) {
+        sprite_slab[ids[k]].draw(&sprite_slab[ids[k]], v, p);
+    }
+#endif
+}
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/// image and drawing for scene slot id, its bound sized to the image
+static Sprite* new_sprite(const char* file, int id)
 {
     static SDL_Surface* surf = NULL;
     static SDL_Texture* tex = NULL;
     static int tw = 0, th = 0;
 
-    Sprite* res = &sprite_slab[sprite_sp++];
+    Sprite* res = &sprite_slab[id];
+    res->st = scene_state(id);
     //memset(res, 0, sizeof *res);
 
 #ifdef USE_OPENGL
@@ -157,10 +256,15 @@ Sprite* load_sprite(const char* file)
         }
         tw = surf->w;
         th = surf->h;
+        sprite_extent = MAX(sprite_extent, MAX(tw, th));
 
 #ifdef USE_OPENGL
         tex = SDL_CreateTextureFromSurface(renderer, surf);
         SDL_FreeSurface(surf);
+#else
+        if (use_composite) {
+            surf = convert_for_composite(surf, true);
+        }
 #endif
     }
 
@@ -170,68 +274,135 @@ Sprite* load_sprite(const char* file)
     res->surface = surf;
 #endif
 
-    res->bound = (SDL_Rect) { dist(rd), dist(rd), tw, th };
+    res->st->bound.w = tw, res->st->bound.h = th;
     res->draw = sprite_draw;
-    res->update = sprite_update;
     //char l[64];
     //std::snprintf(l, sizeof l - 1, "%s %u", file, sprite_sp);
-    //res->label = strdup(l);
+    //res->st->label = strdup(l);
+
+    return res;
+}
 
+Sprite* load_sprite(const char* file)
+{
+    int id = scene_add();
+    if (id < 0) return NULL;
+
+    Sprite* res = new_sprite(file, id);
+    scene_spawn(id);
     return res;
 }
 
 static void update()
 {
-    for (int i = 0; i < sprite_sp; i++) {
-        sprite_slab[i].update(&sprite_slab[i]);
+    wheel_advance(current_time);
+    behavior_run(current_time);
+    nav_poll();
+    scene_update();
+
+    // bucket everyone once, every view culls against the same grid
+    int n = scene_count();
+    int* xy = frame_alloc_array<int>(n * 2);
+    for (int i = 0; i < n; i++) {
+        const Rect& b = sprite_slab[i].st->bound;
+        xy[2*i] = b.x + b.w/2, xy[2*i + 1] = b.y + b.h/2;
     }
+    views_index(xy, n);
 
+    // edge scrolling for the view under the mouse
     {
         int x, y;
         SDL_GetMouseState(&x, &y);
-        int w = screen_w, h = screen_h;
-        if (x < 50) {
-            bg_x = MAX(bg_x-2, 0);
-        } else if (x > w-50) {
-            bg_x = MIN(bg_x+2, bg->w - w);
-        }
+        int i = view_at(x, y);
+        if (i >= 0) {
+            View* v = view_get(i);
+            int dx = 0, dy = 0;
+            if (x < v->x + 50) {
+                dx = -2;
+            } else if (x > v->x + v->w - 50) {
+                dx = 2;
+            }
 
-        if (y < 50) {
-            bg_y = MAX(bg_y-2, 0);
-        } else if (y > h-50) {
-            bg_y = MIN(bg_y+2, bg->h - h);
+            if (y < v->y + 50) {
+                dy = -2;
+            } else if (y > v->y + v->h - 50) {
+                dy = 2;
+            }
+            if (dx || dy) view_scroll(v, dx, dy);
         }
     }
 }
 
-static void draw()
+/// allocs: alloc_count() when the frame started
+static void draw(unsigned long allocs)
 {
     cerr << __func__ << ": " << SDL_GetTicks() << endl;
-    SDL_Rect r = { bg_x, bg_y, screen_w, screen_h };
+#ifndef USE_OPENGL
+    if (use_composite) {
+        if (SDL_MUSTLOCK(surface)) SDL_LockSurface(surface);
+        screen_pix = surface_pixmap(surface);
+    }
+#endif
+
+    // views only go parallel through our own kernels, SDL is single threaded.
+    // sprites are indexed by center, the margin covers their size and trail.
+    views_render(draw_view, NULL, sprite_extent + 40, use_composite);
 #ifdef USE_OPENGL
-    SDL_RenderCopy(renderer, bg_tex, &r, NULL);
+    SDL_RenderSetViewport(renderer, NULL);
 #else
-    SDL_BlitSurface(bg, &r, surface, NULL);
+    if (!use_composite) SDL_SetClipRect(surface, NULL);
 #endif
 
-    for (int i = 0; i < sprite_sp; i++) {
-        sprite_slab[i].draw(&sprite_slab[i]);
-    }
+    alloc_check_frame(__func__, frame_no++, allocs);
+    frame_reset();
 
 #ifdef USE_OPENGL
+    if (capture_active()) {
+        if (uint32_t* buf = capture_acquire()) {
+            SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_ARGB8888, buf, screen_w * 4);
+            capture_submit(buf);
+        }
+    }
     SDL_RenderPresent( renderer );
 #else
+    if (capture_active()) {
+        bool lock = !use_composite && SDL_MUSTLOCK(surface);
+        if (lock) SDL_LockSurface(surface);
+        Pixmap p = surface_pixmap(surface);
+        capture_frame(&p);
+        if (lock) SDL_UnlockSurface(surface);
+    }
+    if (use_composite && SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
     SDL_UpdateWindowSurface(window);
 #endif
 }
 
+/// optional passability mask aligned with the background, open map without
+static void load_navmap()
+{
+    SDL_Surface* m = IMG_Load("background-mask.png");
+    if (!m) {
+        err_warn("no navigation mask, map is all passable\n");
+        nav_init(NULL, bg_w, bg_h, NAV_CELL);
+    } else {
+        SDL_Surface* c = SDL_ConvertSurfaceFormat(m, SDL_PIXELFORMAT_ARGB8888, 0);
+        SDL_FreeSurface(m);
+        if (!c) {
+            err_quit("convert navigation mask failed: %s\n", SDL_GetError());
+        }
+        Pixmap p = surface_pixmap(c);
+        nav_init(&p, bg_w, bg_h, NAV_CELL);
+        SDL_FreeSurface(c);
+    }
+}
+
 static void spawn_sprites(int n)
 {
     while (n--) {
         load_sprite("sprite.png");
     }
 
-    std::cerr << "spawn sprites done" << sprite_sp << std::endl;
+    std::cerr << "spawn sprites done" << scene_count() << std::endl;
 }
 
 int main(int argc, char *argv[])
@@ -291,6 +462,23 @@ int main(int argc, char *argv[])
     }
     cerr << "window: " << surface->w << "," << surface->h << endl;
     cerr << SDL_GetPixelFormatName(surface->format->format) << endl;
+
+    use_composite = composite_compatible(surface->format);
+    if (use_composite) {
+        cerr << "composite: " << composite_impl_name(composite_init()) << endl;
+    }
+#endif
+
+#ifdef USE_OPENGL
+    // read back as ARGB8888 below
+    capture_start_from_env(screen_w, screen_h, CAPTURE_ARGB);
+#else
+    if (surface->format->BytesPerPixel == 4) {
+        SDL_PixelFormat* f = surface->format;
+        capture_start_from_env(surface->w, surface->h, (CaptureMasks) { f->Rmask, f->Gmask, f->Bmask });
+    } else if (getenv("NAVGUIDE_CAPTURE")) {
+        err_warn("capture needs a 32bpp window surface\n");
+    }
 #endif
 
     if (!(IMG_Init(IMG_INIT_JPG|IMG_INIT_PNG))) {
@@ -301,13 +489,41 @@ int main(int argc, char *argv[])
         err_quit("load background failed\n");
     }
     SDL_SetSurfaceBlendMode(bg, SDL_BLENDMODE_NONE);
+    bg_w = bg->w, bg_h = bg->h;
     cerr << "background: " << bg->w << "," << bg->h << endl;
 #ifdef USE_OPENGL
     bg_tex = SDL_CreateTextureFromSurface(renderer, bg);
     SDL_FreeSurface(bg);
+#else
+    if (use_composite) {
+        bg = convert_for_composite(bg, false);
+    }
 #endif
     
-    spawn_sprites(NSPAWN);
+    views_init(screen_w, screen_h, bg_w, bg_h, MAX_SPRITES);
+    load_navmap();
+    // one behaviour timer per sprite plus the snapshot timer
+    wheel_init(SDL_GetTicks(), MAX_SPRITES + 1);
+    behavior_init(SDL_GetTicks(), MAX_SPRITES);
+    scene_init(MAX_SPRITES, bg_w, bg_h);
+
+    const char* snap_path = getenv("NAVGUIDE_SNAPSHOT");
+    unsigned int now = SDL_GetTicks();
+    int restored = snap_path ? scene_restore(snap_path) : -1;
+    if (restored >= 0) {
+        for (int i = 0; i < restored; i++) {
+            new_sprite("sprite.png", i);
+        }
+        cerr << "restored " << restored << " sprites from " << snap_path << " in "
+            << SDL_GetTicks() - now << "ms" << endl;
+    } else {
+        spawn_sprites(NSPAWN);
+        scene_place_dests(sprite_extent);
+    }
+    if (snap_path) {
+        snapshot_start(snap_path, MAX_SPRITES);
+        wheel_add(SDL_GetTicks() + SNAPSHOT_PERIOD, scene_save, 0);
+    }
     
     refresh_time = SDL_GetTicks() + 500;
     int quit = 0;
@@ -335,18 +551,40 @@ int main(int argc, char *argv[])
                     break;
                 }
 
+                case SDL_MOUSEWHEEL:
+                {
+                    int x, y;
+                    SDL_GetMouseState(&x, &y);
+                    int i = view_at(x, y);
+                    if (i >= 0 && e.wheel.y) {
+                        view_zoom(view_get(i), e.wheel.y > 0 ? 2.0f : 0.5f, x, y);
+                    }
+                    break;
+                }
+
                 default: break;
             }
         }
         //SDL_Delay(30);
 
         if (SDL_TICKS_PASSED(SDL_GetTicks(), refresh_time)) {
+            unsigned long allocs = alloc_count();
             update();
-            draw();
+            draw(allocs);
             refresh_time += 500;
         }
     }
 
+    if (snap_path) {
+        scene_save(-1, SDL_GetTicks());
+        snapshot_stop();
+    }
+    behavior_shutdown();
+    scene_shutdown();
+    views_shutdown();
+    capture_stop();
+    nav_shutdown();
+
 #ifdef USE_OPENGL
     SDL_DestroyRenderer(renderer);
 #else
@@ -0,0 +1,406 @@
+#include "scene.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include "behavior.h"
+#include "nav.h"
+#include "views.h"
+#include "wheel.h"
+
+using namespace std;
+
+static_assert(SCENE_NDEST <= SNAP_MAX_DEST, "destinations must fit a snapshot");
+
+/// what the scripts steer a sprite with, rebuilt on restore
+typedef struct {
+    SpriteState* st; /// scene.state entry of the same slot
+    int nav; /// flow field toward dests[st->dest], -1 for none
+    BehaviorSignal halted; /// raised on arrival or when blocked
+} SceneAgent;
+
+typedef struct {
+    int x, y;
+} Point;
+
+static struct {
+    vector<SpriteState> state;
+    vector<SceneAgent> agents;
+    int count;
+    int map_w, map_h;
+
+    /// points of interest agents walk between, map coordinates
+    Point dests[SCENE_NDEST];
+} scene;
+
+static random_device rd;
+static SnapRng rng(rd()); /// all simulation randomness, saved with the scene
+static uniform_int_distribution<int> dist(0, 800);
+static uniform_int_distribution<int> dir_dist(1, 4);
+static uniform_int_distribution<int> dest_dist(0, SCENE_NDEST-1);
+
+void scene_init(int capacity, int map_w, int map_h)
+{
+    scene.state.assign(capacity, SpriteState());
+    scene.agents.assign(capacity, SceneAgent());
+    scene.count = 0;
+    scene.map_w = map_w, scene.map_h = map_h;
+}
+
+void scene_shutdown()
+{
+    for (int i = 0; i < scene.count; i++) {
+        if (scene.agents[i].nav >= 0) nav_release(scene.agents[i].nav);
+    }
+    scene.state.clear();
+    scene.agents.clear();
+    scene.count = 0;
+}
+
+int scene_add()
+{
+    if (scene.count == (int)scene.state.size()) return -1;
+
+    int id = scene.count++;
+    SceneAgent* a = &scene.agents[id];
+    memset(&scene.state[id], 0, sizeof(SpriteState));
+    a->st = &scene.state[id];
+    a->st->dest = a->nav = -1;
+    a->halted.head = 0;
+    return id;
+}
+
+int scene_count()
+{
+    return scene.count;
+}
+
+SpriteState* scene_state(int id)
+{
+    return &scene.state[id];
+}
+
+//
+// agent behaviours, scripts run by the behaviour scheduler. scene_update
+// moves every sprite along s->st->dir each frame, scripts only change course.
+//
+
+/// script kinds and what a script is suspended on, kept in the sprite state
+/// so a restored script picks up where it was saved
+enum {
+    SCRIPT_WANDER, SCRIPT_PATROL, SCRIPT_FOLLOW
+};
+
+enum {
+    WAIT_NONE = 0, WAIT_HALTED, WAIT_DELAY
+};
+
+static BehaviorAwait wait_halted(SceneAgent* s, unsigned int timeout)
+{
+    s->st->wait = WAIT_HALTED;
+    return behavior_wait(&s->halted, timeout);
+}
+
+static BehaviorAwait wait_delay(SceneAgent* s, unsigned int ms)
+{
+    s->st->wait = WAIT_DELAY;
+    return behavior_delay(ms);
+}
+
+/// the wait a restored script was saved in, with what was left of it
+static BehaviorAwait wait_saved(SceneAgent* s)
+{
+    const SpriteState* st = s->st;
+    if (st->wait == WAIT_DELAY) {
+        return wait_delay(s, max(st->turn_in, 0));
+    }
+    if (st->signalled) {
+        return behavior_tick(); // resumes as if signalled
+    }
+    // a wait that had already timed out times out again right away
+    return wait_halted(s, st->turn_in < 0 ? 0 : max(st->turn_in, 1));
+}
+
+static int acquire_dest(int d)
+{
+    return nav_acquire(scene.dests[d].x, scene.dests[d].y);
+}
+
+/// head for a random point of interest, random walk while there is no
+/// route to it
+static Behavior wander(SceneAgent* s, bool resume)
+{
+    if (resume) co_await wait_saved(s);
+    for (;;) {
+        if (s->nav < 0) {
+            if (s->st->dest < 0) s->st->dest = dest_dist(rng);
+            s->nav = acquire_dest(s->st->dest);
+            if (s->nav < 0) s->st->dest = -1;
+        }
+
+        int cx = s->st->bound.x + s->st->bound.w/2, cy = s->st->bound.y + s->st->bound.h/2;
+        if (s->nav < 0 || nav_dir(s->nav, cx, cy) == NAV_NONE) {
+            s->st->dir = (Direction)dir_dist(rng);
+            co_await wait_halted(s, 5000);
+        } else {
+            co_await wait_halted(s, 0);
+        }
+    }
+}
+
+/// follow the field toward dests[d] until arrival, wandering while it is
+/// not ready or does not reach us. a resumed walk already holds its field.
+static Behavior walk_to(SceneAgent* s, int d, bool resume = false)
+{
+    if (resume) {
+        co_await wait_saved(s);
+    } else {
+        s->st->dest = d;
+        s->nav = acquire_dest(d);
+        if (s->nav < 0) {
+            s->st->dest = -1;
+            co_return;
+        }
+    }
+
+    while (s->nav >= 0) {
+        int cx = s->st->bound.x + s->st->bound.w/2, cy = s->st->bound.y + s->st->bound.h/2;
+        if (nav_dir(s->nav, cx, cy) == NAV_NONE) {
+            s->st->dir = (Direction)dir_dist(rng);
+        }
+        co_await wait_halted(s, 1000);
+    }
+}
+
+/// visit the points of interest in turn, resting at each
+static Behavior patrol(SceneAgent* s, unsigned int rest, bool resume)
+{
+    SpriteState* st = s->st;
+    if (resume) {
+        // saved walking a leg or resting after it
+        if (st->wait == WAIT_DELAY) {
+            co_await wait_saved(s);
+        } else {
+            co_await walk_to(s, st->leg, true);
+            co_await wait_delay(s, rest);
+        }
+        st->leg = (st->leg + 1) % SCENE_NDEST;
+    } else {
+        st->leg = st->dest >= 0 ? st->dest : dest_dist(rng);
+    }
+
+    for (;; st->leg = (st->leg + 1) % SCENE_NDEST) {
+        co_await walk_to(s, st->leg);
+        co_await wait_delay(s, rest);
+    }
+}
+
+/// keep close to a leader, aim a few times a second
+static Behavior follow(SceneAgent* s, const SceneAgent* leader, bool resume)
+{
+    for (;; resume = false) {
+        if (resume && s->st->wait == WAIT_DELAY) {
+            co_await wait_saved(s); // going around
+            continue;
+        }
+
+        if (!resume) {
+            int dx = leader->st->bound.x - s->st->bound.x, dy = leader->st->bound.y - s->st->bound.y;
+            if (abs(dx) + abs(dy) < 2 * s->st->bound.w) {
+                s->st->dir = leader->st->dir;
+            } else if (abs(dx) > abs(dy)) {
+                s->st->dir = dx > 0 ? Right : Left;
+            } else {
+                s->st->dir = dy > 0 ? Down : Up;
+            }
+        }
+
+        if (co_await (resume ? wait_saved(s) : wait_halted(s, 250))) {
+            // blocked, go around for a bit
+            s->st->dir = (Direction)dir_dist(rng);
+            co_await wait_delay(s, 500);
+        }
+    }
+}
+
+/// every ten sprites one patrols with two followers, the rest wander.
+/// resume picks up a restored script where it was saved.
+static void start_behavior(int id, unsigned int delay, bool resume = false)
+{
+    SceneAgent* s = &scene.agents[id];
+    SpriteState* st = s->st;
+    if (!resume) {
+        st->script = id % 10 == 0 ? SCRIPT_PATROL : id % 10 < 3 ? SCRIPT_FOLLOW : SCRIPT_WANDER;
+        st->leader = st->script == SCRIPT_FOLLOW ? id - id % 10 : -1;
+        st->wait = WAIT_NONE;
+        st->signalled = 0;
+    }
+
+    switch (st->script) {
+        case SCRIPT_PATROL:
+            behavior_start(id, patrol(s, 3000, resume), delay); break;
+        case SCRIPT_FOLLOW:
+            behavior_start(id, follow(s, &scene.agents[st->leader], resume), delay); break;
+        default:
+            behavior_start(id, wander(s, resume), delay); break;
+    }
+}
+
+void scene_spawn(int id)
+{
+    Rect& b = scene.state[id].bound;
+    int tries = 100;
+    do {
+        b.x = dist(rng), b.y = dist(rng);
+    } while (!nav_passable(b.x + b.w/2, b.y + b.h/2) && --tries);
+    start_behavior(id, 0);
+}
+
+/// the clamp in sprite_update() keeps centers half a sprite away from the
+/// map edge
+void scene_place_dests(int sprite_extent)
+{
+    int inset = sprite_extent / 2;
+    uniform_int_distribution<int> xd(inset, scene.map_w - 1 - inset), yd(inset, scene.map_h - 1 - inset);
+    for (int i = 0; i < SCENE_NDEST; i++) {
+        int tries = 100;
+        Point& d = scene.dests[i];
+        do {
+            d = (Point) { xd(rng), yd(rng) };
+        } while (!nav_passable(d.x, d.y) && --tries);
+    }
+}
+
+static void sprite_update(SceneAgent* s)
+{
+    int cx = s->st->bound.x + s->st->bound.w/2, cy = s->st->bound.y + s->st->bound.h/2;
+    if (s->nav >= 0 && nav_arrived(s->nav, cx, cy)) {
+        nav_release(s->nav);
+        s->nav = s->st->dest = -1;
+        behavior_notify(&s->halted);
+    }
+
+    int dir = s->nav >= 0 ? nav_dir(s->nav, cx, cy) : NAV_NONE;
+    if (dir != NAV_NONE) {
+        s->st->dir = (Direction)dir;
+    }
+
+    int step = 8, dx = 0, dy = 0;
+    switch(s->st->dir) {
+        case Up:
+            dy = -step; break;
+        case Down:
+            dy = step; break;
+        case Left:
+            dx = -step; break;
+        default: // right
+            dx = step; break;
+    }
+
+    int x = min(max(s->st->bound.x + dx, 0), scene.map_w - s->st->bound.w);
+    int y = min(max(s->st->bound.y + dy, 0), scene.map_h - s->st->bound.h);
+    // a step the map edge clamps away blocks like the mask does
+    if (nav_passable(cx + dx, cy + dy) && (x != s->st->bound.x || y != s->st->bound.y)) {
+        s->st->bound.x = x;
+        s->st->bound.y = y;
+    } else {
+        behavior_notify(&s->halted); // blocked, scripts react next frame
+    }
+
+    memmove(&s->st->traits[1], &s->st->traits, sizeof(s->st->traits[0])*(SCENE_TRAIL-1));
+    s->st->traits[0] = (Rect) {
+        s->st->bound.x + (s->st->bound.w - 10)/2, s->st->bound.y + (s->st->bound.h - 10)/2, 10, 10
+    };
+}
+
+void scene_update()
+{
+    for (int i = 0; i < scene.count; i++) {
+        sprite_update(&scene.agents[i]);
+    }
+}
+
+//
+// scene snapshots
+//
+
+void scene_save(int owner, unsigned int now)
+{
+    if (owner >= 0) {
+        wheel_add(now + SNAPSHOT_PERIOD, scene_save, owner);
+    }
+
+    // the final save waits out a periodic one still being written
+    SnapSprite* recs = snapshot_begin(scene.count, owner < 0);
+    if (!recs) return; // previous save still being written
+
+    memcpy(recs, scene.state.data(), scene.count * sizeof(SpriteState));
+    for (int i = 0; i < scene.count; i++) {
+        // a woken script resumes next frame, keep how its wait ended
+        bool signalled;
+        bool ready = behavior_ready(i, &signalled);
+        recs[i].signalled = signalled;
+        recs[i].turn_in = ready ? 0 : behavior_timeout(i, now);
+    }
+
+    SnapView v;
+    memset(&v, 0, sizeof v);
+    // only the first view's scroll is kept
+    v.bg_x = view_get(0)->map_x, v.bg_y = view_get(0)->map_y;
+    v.ndest = SCENE_NDEST;
+    for (int i = 0; i < SCENE_NDEST; i++) {
+        v.dests[i][0] = scene.dests[i].x, v.dests[i][1] = scene.dests[i].y;
+    }
+    snapshot_commit(&v, scene.count, rng);
+}
+
+int scene_restore(const char* path)
+{
+    Snapshot snap;
+    if (!snapshot_open(path, &snap)) {
+        return -1;
+    }
+
+    const SnapView& v = snap.header->view;
+    view_place(view_get(0), v.bg_x, v.bg_y);
+    for (int i = 0; i < SCENE_NDEST && i < v.ndest; i++) {
+        scene.dests[i] = (Point) { v.dests[i][0], v.dests[i][1] };
+    }
+
+    int n = min(snap.count, (int)scene.state.size());
+    if (n < snap.count) {
+        fprintf(stderr, "snapshot: %d sprites, only the first %d restored\n", snap.count, n);
+    }
+    for (int i = 0; i < n; i++) {
+        scene_add();
+    }
+    memcpy(scene.state.data(), snap.sprites, n * sizeof(SpriteState));
+
+    for (int i = 0; i < n; i++) {
+        SceneAgent* s = &scene.agents[i];
+        SpriteState* st = s->st;
+        st->label[SNAP_LABEL_LEN-1] = 0;
+        if (st->dest < -1 || st->dest >= SCENE_NDEST) st->dest = -1;
+        if (st->dest >= 0) {
+            s->nav = acquire_dest(st->dest);
+        }
+
+        // scripts carry on from their saved wait, ones that never ran or
+        // don't check out start over once the saved delay is up
+        bool resume = st->wait != WAIT_NONE &&
+            st->script >= SCRIPT_WANDER && st->script <= SCRIPT_FOLLOW &&
+            (st->script != SCRIPT_PATROL || (st->leg >= 0 && st->leg < SCENE_NDEST)) &&
+            (st->script != SCRIPT_FOLLOW || (st->leader >= 0 && st->leader < n));
+        start_behavior(i, resume ? 0 : max(st->turn_in, 0), resume);
+    }
+
+    if (!snapshot_restore_rng(&snap, &rng)) {
+        fprintf(stderr, "snapshot: bad rng state, reseeded\n");
+    }
+    snapshot_close(&snap);
+    return n;
+}
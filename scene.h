@@ -0,0 +1,78 @@
+#ifndef NAVGUIDE_SCENE_H
+#define NAVGUIDE_SCENE_H
+
+#include "snapshot.h"
+
+/// the simulation both frontends run: sprite state, the behaviour scripts
+/// steering it, one step of movement per frame, the points of interest and
+/// scene snapshots. frontends own images, labels and drawing, and address
+/// sprites by slot.
+///
+/// render thread only. scene_init() after nav_init(), views_init() and
+/// behavior_init(), the scripts use all three.
+
+#define SCENE_NDEST 8 /// points of interest, at most SNAP_MAX_DEST
+#define SCENE_TRAIL SNAP_TRAIL
+#define SNAPSHOT_PERIOD 10000
+
+typedef enum {
+    Up = 1, Down, Right, Left /// same values as NAV_UP..NAV_LEFT
+} Direction;
+
+typedef struct {
+    int x, y;
+    int w, h;
+} Rect;
+
+/// what a snapshot keeps of a sprite, laid out as SnapSprite so saving and
+/// restoring copy the whole table at once
+typedef struct {
+    Rect bound; /// x,y used as postion, w,h used ad bound
+    Direction dir;
+    int dest; /// destination index, -1 for none
+    int script; /// SCRIPT_*
+    int leg; /// patrol: destination being walked to
+    int leader; /// follow: sprite followed
+    int wait; /// WAIT_*, what the script is suspended on
+    int signalled; /// set when saving, the wait already ended on its signal
+    int turn_in; /// set when saving, ms left on the wait or start delay
+    Rect traits[SCENE_TRAIL]; /// trail squares in map coordinates, newest first
+    char label[SNAP_LABEL_LEN];
+} SpriteState;
+
+static_assert(sizeof(SpriteState) == sizeof(SnapSprite) &&
+        offsetof(SpriteState, turn_in) == offsetof(SnapSprite, turn_in) &&
+        offsetof(SpriteState, traits) == offsetof(SnapSprite, trail) &&
+        offsetof(SpriteState, label) == offsetof(SnapSprite, label),
+        "SpriteState must match SnapSprite");
+
+/// room for capacity sprites on a map_w x map_h map
+void scene_init(int capacity, int map_w, int map_h);
+void scene_shutdown();
+
+/// next slot, zeroed and without a script, -1 when full. the frontend
+/// sizes its bound to the sprite image before scene_spawn().
+int scene_add();
+int scene_count();
+SpriteState* scene_state(int id);
+
+/// random passable spot for a fresh sprite, and its script started
+void scene_spawn(int id);
+
+/// destinations sprite centers can reach, inset by half the largest sprite
+void scene_place_dests(int sprite_extent);
+
+/// one step along every sprite's course, after behavior_run()
+void scene_update();
+
+/// wheel callback, copies the scene at a frame boundary for the snapshot
+/// writer. owner < 0 is a one off save that does not reschedule and waits
+/// out a save still being written.
+void scene_save(int owner, unsigned int now);
+
+/// sprites, view 0 scroll, destinations, scripts and rng from the snapshot
+/// at path. returns the sprites restored, their slots are 0..n-1 and still
+/// need images, or -1 when there is no usable snapshot.
+int scene_restore(const char* path);
+
+#endif
@@ -0,0 +1,221 @@
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static const char snap_magic[8] = { 'N', 'A', 'V', 'S', 'N', 'A', 'P', 0 };
+
+static struct {
+    string path;
+
+    /// staging copy, render thread between begin and commit, writer after
+    vector<SnapSprite> records;
+    SnapView view;
+    SnapRng rng;
+    int count;
+
+    bool busy;      /// writer owns the staging copy
+    bool stopping;
+    bool active;
+
+    mutex lock;
+    condition_variable cond;
+    thread writer;
+} snap;
+
+static bool write_all(int fd, const void* buf, size_t len)
+{
+    const char* p = (const char*)buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool save()
+{
+    ostringstream os;
+    os << snap.rng;
+    string rng = os.str();
+
+    size_t body = snap.count * sizeof(SnapSprite);
+    SnapHeader h;
+    memset(&h, 0, sizeof h);
+    memcpy(h.magic, snap_magic, sizeof h.magic);
+    h.version = SNAP_VERSION;
+    h.header_size = sizeof(SnapHeader);
+    h.record_size = sizeof(SnapSprite);
+    h.count = snap.count;
+    h.rng_len = rng.size();
+    h.saved_at = time(NULL);
+    h.view = snap.view;
+
+    uLong crc = crc32(0, (const Bytef*)&h.view, sizeof h.view);
+    crc = crc32(crc, (const Bytef*)snap.records.data(), body);
+    h.crc = crc32(crc, (const Bytef*)rng.data(), rng.size());
+
+    string tmp = snap.path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0) return false;
+
+    bool ok = write_all(fd, &h, sizeof h) &&
+        write_all(fd, snap.records.data(), body) &&
+        write_all(fd, rng.data(), rng.size()) &&
+        fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+
+    return ok && rename(tmp.c_str(), snap.path.c_str()) == 0;
+}
+
+static void writer_main()
+{
+    unique_lock<mutex> lk(snap.lock);
+    for (;;) {
+        snap.cond.wait(lk, [] { return snap.busy || snap.stopping; });
+        if (!snap.busy) break;
+
+        lk.unlock();
+        if (!save()) {
+            fprintf(stderr, "snapshot: save to %s failed: %s\n", snap.path.c_str(), strerror(errno));
+        }
+        lk.lock();
+
+        snap.busy = false;
+        snap.cond.notify_all();
+    }
+}
+
+bool snapshot_start(const char* path, int max_sprites)
+{
+    if (snap.active) return false;
+
+    snap.path = path;
+    snap.records.resize(max_sprites);
+    snap.busy = snap.stopping = false;
+    snap.writer = thread(writer_main);
+    snap.active = true;
+
+    static bool registered = false;
+    if (!registered) {
+        atexit(snapshot_stop);
+        registered = true;
+    }
+    return true;
+}
+
+SnapSprite* snapshot_begin(int n, bool wait)
+{
+    if (!snap.active || n > (int)snap.records.size()) return NULL;
+
+    unique_lock<mutex> lk(snap.lock);
+    if (wait) snap.cond.wait(lk, [] { return !snap.busy; });
+    return snap.busy ? NULL : snap.records.data();
+}
+
+void snapshot_commit(const SnapView* view, int n, const SnapRng& rng)
+{
+    {
+        lock_guard<mutex> lk(snap.lock);
+        snap.view = *view;
+        snap.count = n;
+        snap.rng = rng;
+        snap.busy = true;
+    }
+    snap.cond.notify_all();
+}
+
+void snapshot_stop()
+{
+    if (!snap.active) return;
+    {
+        unique_lock<mutex> lk(snap.lock);
+        snap.cond.wait(lk, [] { return !snap.busy; });
+        snap.stopping = true;
+    }
+    snap.cond.notify_all();
+    snap.writer.join();
+    snap.active = false;
+}
+
+bool snapshot_open(const char* path, Snapshot* s)
+{
+    memset(s, 0, sizeof *s);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SnapHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    s->map = map;
+    s->len = st.st_size;
+
+    const SnapHeader* h = (const SnapHeader*)map;
+    const char* why = NULL;
+    if (memcmp(h->magic, snap_magic, sizeof h->magic)) {
+        why = "not a snapshot";
+    } else if (h->version != SNAP_VERSION || h->header_size != sizeof(SnapHeader) ||
+            h->record_size != sizeof(SnapSprite)) {
+        why = "version mismatch";
+    } else if (sizeof(SnapHeader) + (size_t)h->count * sizeof(SnapSprite) + h->rng_len != s->len) {
+        why = "truncated";
+    } else {
+        const Bytef* body = (const Bytef*)map + sizeof(SnapHeader);
+        uLong crc = crc32(0, (const Bytef*)&h->view, sizeof h->view);
+        if (crc32(crc, body, s->len - sizeof(SnapHeader)) != h->crc) why = "checksum mismatch";
+    }
+
+    if (why) {
+        fprintf(stderr, "snapshot: %s: %s, ignored\n", path, why);
+        snapshot_close(s);
+        return false;
+    }
+
+    s->header = h;
+    s->sprites = (const SnapSprite*)((const char*)map + sizeof(SnapHeader));
+    s->count = h->count;
+    return true;
+}
+
+bool snapshot_restore_rng(const Snapshot* s, SnapRng* rng)
+{
+    const char* text = (const char*)(s->sprites + s->count);
+    istringstream is(string(text, s->header->rng_len));
+    SnapRng r;
+    if (!(is >> r)) return false;
+    *rng = r;
+    return true;
+}
+
+void snapshot_close(Snapshot* s)
+{
+    if (s->map) munmap(s->map, s->len);
+    memset(s, 0, sizeof *s);
+}
@@ -0,0 +1,88 @@
+#ifndef NAVGUIDE_SNAPSHOT_H
+#define NAVGUIDE_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <random>
+
+/// versioned binary scene snapshot for warm restarts.
+///
+/// layout, native endian:
+///   SnapHeader | SnapSprite[count] | rng state (text, rng_len bytes)
+/// crc covers the header's view and everything after the header. a save
+/// goes to <path>.tmp and is renamed over <path> once synced, so a crash
+/// never leaves a torn file.
+///
+/// saving: the render thread fills the staging records at a frame boundary
+/// (snapshot_begin / snapshot_commit) and a writer thread does the I/O.
+/// restoring: snapshot_open() maps the file read only and validates it,
+/// the caller copies records straight out of the mapping. SnapSprite is
+/// plain data so the game can keep its sprite state in the same layout and
+/// copy the whole table at once.
+
+#define SNAP_VERSION 3
+#define SNAP_LABEL_LEN 32
+#define SNAP_MAX_DEST 16
+#define SNAP_TRAIL 5
+
+typedef std::mt19937 SnapRng;
+
+typedef struct {
+    int32_t x, y, w, h;
+    int32_t dir;
+    int32_t dest;           /// destination index, -1 for none
+    /// behaviour script and how far it got, kinds are the game's
+    int32_t script;
+    int32_t leg;            /// patrol: destination being walked to
+    int32_t leader;         /// follow: sprite followed
+    int32_t wait;           /// what the script is suspended on, 0 not started
+    int32_t signalled;      /// the wait already ended on its signal
+    int32_t turn_in;        /// ms left on the wait or start delay, -1 for none
+    int32_t trail[SNAP_TRAIL][4];
+    char label[SNAP_LABEL_LEN];
+} SnapSprite;
+
+typedef struct {
+    int32_t bg_x, bg_y;
+    int32_t ndest;
+    int32_t dests[SNAP_MAX_DEST][2];
+} SnapView;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t count;
+    uint32_t rng_len;
+    uint32_t crc;
+    int64_t saved_at;       /// unix time, informational
+    SnapView view;
+} SnapHeader;
+
+/// writer thread saving to path, staging room for max_sprites records
+bool snapshot_start(const char* path, int max_sprites);
+
+/// staging records for n sprites, NULL while the previous save is still
+/// being written (skip this one) unless wait blocks until it is done
+SnapSprite* snapshot_begin(int n, bool wait = false);
+void snapshot_commit(const SnapView* view, int n, const SnapRng& rng);
+
+/// waits for a pending save and joins the writer
+void snapshot_stop();
+
+typedef struct {
+    void* map;
+    size_t len;
+    const SnapHeader* header;
+    const SnapSprite* sprites;
+    int count;
+} Snapshot;
+
+/// map and validate, false if missing, truncated, wrong version or corrupt
+bool snapshot_open(const char* path, Snapshot* snap);
+bool snapshot_restore_rng(const Snapshot* snap, SnapRng* rng);
+void snapshot_close(Snapshot* snap);
+
+#endif
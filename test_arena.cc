@@ -0,0 +1,165 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+#include "alloc_count.h"
+#include "arena.h"
+#include "views.h"
+
+/// a frame that outgrows the arena spills to the heap once, the reset
+/// regrows the block past the high water mark and the same frame after it
+/// makes no heap allocation. the counter must see every way the frame loop
+/// can reach the heap: malloc, new, aligned new, aligned_alloc and
+/// posix_memalign, on the render thread or on a view render worker.
+
+#define SMALL 1000
+#define BIG 40000 /// ints, 160k a piece, two of them spill the first block
+
+using namespace std;
+
+static int failed;
+
+static void fail(const char* what)
+{
+    fprintf(stderr, "%s\n", what);
+    failed++;
+}
+
+struct alignas(64) Line {
+    char bytes[64];
+};
+
+/// out of line so the compiler can not drop a new/delete pair
+static void __attribute__((noinline)) keep(void* p)
+{
+    asm volatile("" : : "r"(p) : "memory");
+}
+
+/// one frame's worth of temporaries, each filled so spills are touched
+static void frame(int n, int size)
+{
+    for (int k = 0; k < n; k++) {
+        int* p = frame_alloc_array<int>(size);
+        if (!p) return fail("frame_alloc returned NULL");
+        if ((uintptr_t)p % 16) fail("frame_alloc result is not 16 byte aligned");
+        memset(p, k, size * sizeof(int));
+        keep(p);
+    }
+}
+
+static void check_counter()
+{
+    unsigned long n = alloc_count();
+    void* p = malloc(10);
+    keep(p);
+    free(p);
+    if (alloc_count() != n + 1) fail("alloc_count missed malloc");
+
+    n = alloc_count();
+    int* i = new int(1);
+    keep(i);
+    delete i;
+    if (alloc_count() != n + 1) fail("alloc_count missed new");
+
+    n = alloc_count();
+    int* a = new int[100];
+    keep(a);
+    delete[] a;
+    if (alloc_count() != n + 1) fail("alloc_count missed new[]");
+
+    n = alloc_count();
+    Line* l = new Line;
+    keep(l);
+    delete l;
+    if (alloc_count() != n + 1) fail("alloc_count missed aligned new");
+
+    n = alloc_count();
+    p = aligned_alloc(64, 256);
+    keep(p);
+    free(p);
+    if (alloc_count() != n + 1) fail("alloc_count missed aligned_alloc");
+
+    n = alloc_count();
+    p = NULL;
+    if (posix_memalign(&p, 64, 256) != 0) fail("posix_memalign failed");
+    keep(p);
+    free(p);
+    if (alloc_count() != n + 1) fail("alloc_count missed posix_memalign");
+}
+
+static thread::id render_thread;
+static atomic<int> on_workers;
+
+/// one allocation per view, the render thread dawdles so workers get some
+static void alloc_view(const View*, const int*, int, void*)
+{
+    void* p = malloc(64);
+    keep(p);
+    free(p);
+    if (this_thread::get_id() == render_thread) {
+        usleep(20000);
+    } else {
+        on_workers++;
+    }
+}
+
+static void check_workers()
+{
+    setenv("NAVGUIDE_VIEWS", "0,0,100,100,1;100,0,100,100,1;0,100,100,100,1;100,100,100,100,1", 1);
+    setenv("NAVGUIDE_VIEW_THREADS", "3", 1);
+    views_init(200, 200, 400, 400, 16);
+    views_index(NULL, 0);
+    render_thread = this_thread::get_id();
+
+    unsigned long n = alloc_count();
+    views_render(alloc_view, NULL, 0, true);
+    unsigned long seen = alloc_count() - n;
+    printf("arena: %d views, %d drawn on workers, %lu allocations seen\n",
+            views_count(), on_workers.load(), seen);
+    if (!on_workers) fail("no view was drawn on a render worker");
+    if (seen != (unsigned long)views_count()) fail("alloc_count missed allocations on the render workers");
+    views_shutdown();
+}
+
+int main()
+{
+    check_counter();
+    check_workers();
+
+    // first touch allocates the block, small frames stay inside it
+    frame(4, SMALL);
+    frame_reset();
+    size_t initial = frame_capacity();
+    unsigned long n = alloc_count();
+    frame(4, SMALL);
+    frame_reset();
+    if (alloc_count() != n) fail("frame inside the arena touched the heap");
+    if (frame_capacity() != initial) fail("arena regrew without a spill");
+
+    // outgrow it: the second big array spills
+    n = alloc_count();
+    frame(2, BIG);
+    if (alloc_count() == n) fail("frame past the arena did not spill");
+    frame_reset();
+    size_t need = 2 * BIG * sizeof(int);
+    printf("arena: %zu bytes, spilled frame of %zu, regrown to %zu\n",
+            initial, need, frame_capacity());
+    if (frame_high_water() < need) fail("high water below the spilled frame");
+    if (frame_capacity() < frame_high_water()) fail("arena not regrown to the high water mark");
+
+    // the same frame now fits, and keeps fitting
+    n = alloc_count();
+    for (int i = 0; i < 10; i++) {
+        frame(2, BIG);
+        frame_reset();
+    }
+    if (alloc_count() != n) fail("steady state frames touched the heap after the regrow");
+
+    printf("arena: %d failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,282 @@
+#include <stdio.h>
+
+#include <vector>
+
+#include "behavior.h"
+#include "wheel.h"
+
+/// scripts resume exactly as often as their awaits say, a behavior_wait()
+/// reports whether its signal or its timeout ended it, an agent stopped or
+/// restarted in the middle of an await leaves no timer, waiter or frame
+/// behind, and behavior_shutdown() empties the timing wheel.
+
+#define AGENTS 16
+#define FRAME 10 /// ms per frame
+
+using namespace std;
+
+typedef struct {
+    unsigned int at;
+    bool signalled;
+} Wake;
+
+static unsigned int now;
+static int resumes[AGENTS];
+static vector<Wake> woke[AGENTS];
+static int destroyed; /// script frames torn down, counted by Guard
+static int failed;
+
+struct Guard {
+    ~Guard() { destroyed++; }
+};
+
+static void fail(const char* what)
+{
+    fprintf(stderr, "%s\n", what);
+    failed++;
+}
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) fail(what);
+}
+
+/// one frame the way the frontends run it
+static void frame()
+{
+    now += FRAME;
+    wheel_advance(now);
+    behavior_run(now);
+}
+
+static void frames(int n)
+{
+    while (n--) frame();
+}
+
+static Behavior ticker(int id)
+{
+    Guard g;
+    for (;;) {
+        co_await behavior_tick();
+        resumes[id]++;
+    }
+}
+
+static Behavior sleeper(int id, unsigned int ms)
+{
+    Guard g;
+    for (;;) {
+        co_await behavior_delay(ms);
+        resumes[id]++;
+    }
+}
+
+static Behavior waiter(int id, BehaviorSignal* sig, unsigned int timeout)
+{
+    Guard g;
+    for (;;) {
+        bool signalled = co_await behavior_wait(sig, timeout);
+        woke[id].push_back((Wake) { now, signalled });
+    }
+}
+
+static vector<unsigned int> notified; /// when notifier() raised its signal
+
+static Behavior notifier(int id, BehaviorSignal* sig, unsigned int ms)
+{
+    for (;;) {
+        co_await behavior_delay(ms);
+        behavior_notify(sig);
+        notified.push_back(now);
+        resumes[id]++;
+    }
+}
+
+/// a few ticks in the caller's agent
+static Behavior steps(int id, int n)
+{
+    Guard g;
+    while (n--) {
+        co_await behavior_tick();
+        resumes[id]++;
+    }
+}
+
+static Behavior nested(int id, unsigned int ms)
+{
+    Guard g;
+    co_await steps(id, 3);
+    co_await behavior_delay(ms);
+    resumes[id]++;
+}
+
+static void reset(int capacity)
+{
+    now = 0;
+    for (int i = 0; i < AGENTS; i++) {
+        resumes[i] = 0;
+        woke[i].clear();
+    }
+    notified.clear();
+    destroyed = 0;
+    wheel_init(now, capacity);
+    behavior_init(now, AGENTS);
+}
+
+static void resume_counts()
+{
+    reset(64);
+    behavior_start(0, ticker(0));
+    behavior_start(1, sleeper(1, 100));
+    behavior_start(2, nested(2, 50));
+    behavior_start(3, ticker(3), 95);
+
+    frame(); // now 10: 0, 1 and 2 start and suspend, 3 sleeps until 95
+    check(behavior_resumed() == 3, "first frame did not start the undelayed scripts");
+    frame(); // 20: ticker and the nested steps only
+    check(behavior_resumed() == 2, "sleeping agents resumed");
+
+    frames(98); // to 1000
+    check(resumes[0] == 99, "ticker resume count");
+    check(resumes[1] == 9, "sleeper resumes, at 110..910"); // next due at 1010
+    check(resumes[2] == 4, "nested script resume count");
+    check(!behavior_running(2) && destroyed == 2, "finished script and its sub-behaviour not torn down");
+    check(resumes[3] == 90, "delayed start resumed before its delay"); // started at 100
+    check(behavior_live() == 3, "live agents after one finished");
+    printf("behavior: resumes %d %d %d %d\n", resumes[0], resumes[1], resumes[2], resumes[3]);
+    behavior_shutdown();
+}
+
+static void signal_or_timeout()
+{
+    reset(64);
+    BehaviorSignal sig = { 0 }, forever = { 0 };
+    behavior_start(0, waiter(0, &sig, 50));
+    behavior_start(1, waiter(1, &forever, 0));
+
+    frame(); // 10: both wait, 0 until 60
+    frames(2); // 30
+    behavior_notify(&sig);
+    bool signalled = false;
+    check(behavior_ready(0, &signalled) && signalled, "notified agent not ready as signalled");
+    frame(); // 40: 0 resumes signalled, waits again until 90
+    check(woke[0].size() == 1 && woke[0][0].at == 40 && woke[0][0].signalled,
+            "wait did not end on its signal");
+
+    now += FRAME;
+    wheel_advance(now); // 50, nothing due
+    check(!behavior_ready(0), "wait ended before its timeout");
+    behavior_run(now);
+    frames(3); // 80
+    check(woke[0].size() == 1, "wait timed out early");
+    now += FRAME;
+    wheel_advance(now); // 90, the timeout fires
+    check(behavior_ready(0, &signalled) && !signalled, "timed out agent not ready as timed out");
+    behavior_run(now);
+    check(woke[0].size() == 2 && woke[0][1].at == 90 && !woke[0][1].signalled,
+            "wait did not end on its timeout");
+
+    frames(100);
+    check(woke[1].empty(), "wait without a timeout ended on its own");
+    behavior_notify(&forever);
+    frame();
+    check(woke[1].size() == 1 && woke[1][0].signalled, "wait without a timeout missed its signal");
+
+    // a signal raised from inside a run wakes its waiters on the next frame
+    behavior_start(2, notifier(2, &forever, 100));
+    frames(32); // raised at 1210, 1310 and 1410
+    check(notified.size() == 3 && woke[1].size() == 4, "signals raised by a script were lost");
+    for (size_t i = 0; i < notified.size() && i + 1 < woke[1].size(); i++) {
+        check(woke[1][i + 1].at == notified[i] + FRAME && woke[1][i + 1].signalled,
+                "signal raised by a script did not wake on the next frame");
+    }
+    printf("behavior: waits %zu with timeout, %zu without\n", woke[0].size(), woke[1].size());
+    behavior_shutdown();
+}
+
+static void stop_and_restart()
+{
+    reset(64);
+    BehaviorSignal sig = { 0 };
+    for (int i = 0; i < 3; i++) behavior_start(i, waiter(i, &sig, 1000));
+    behavior_start(3, nested(3, 500));
+    behavior_start(4, sleeper(4, 300));
+    frames(5); // 3 is in its delay, past the steps
+
+    int timers = wheel_pending();
+    check(timers == 5, "one wheel timer per waiting agent");
+
+    // the middle of the waiter list, waiting with a timeout
+    int before = destroyed;
+    behavior_stop(1);
+    check(!behavior_running(1) && destroyed == before + 1, "stopped waiter not torn down");
+    check(wheel_pending() == timers - 1, "stopped waiter left its timer");
+    behavior_notify(&sig);
+    frame();
+    check(woke[0].size() == 1 && woke[2].size() == 1 && woke[1].empty(),
+            "notify after a stop woke the wrong agents");
+
+    // stopped in a delay after its sub-behaviour finished
+    int pending = wheel_pending();
+    before = destroyed;
+    behavior_stop(3);
+    check(destroyed == before + 1 && wheel_pending() == pending - 1, "stop in a delay left its frame or timer");
+
+    // stopped while its sub-behaviour is suspended, both frames go
+    behavior_start(5, nested(5, 500));
+    frames(2); // in the steps' ticks
+    before = destroyed;
+    behavior_stop(5);
+    check(destroyed == before + 2, "stop mid co_await left the sub-behaviour frame");
+
+    // restart replaces a script suspended in a delay
+    pending = wheel_pending();
+    before = destroyed;
+    behavior_start(4, ticker(4));
+    check(destroyed == before + 1 && wheel_pending() == pending - 1, "restart left the old script's delay");
+    int was = resumes[4];
+    frames(10);
+    check(resumes[4] == was + 9, "restarted agent runs the new script");
+
+    // and one suspended on a signal, which must no longer wake it
+    behavior_start(0, sleeper(0, 1000));
+    behavior_notify(&sig);
+    frame();
+    check(woke[0].size() == 1, "restarted agent woken by its old signal");
+    check(woke[2].size() == 2, "remaining waiter missed the signal");
+    check(behavior_live() == 3, "live agents after stops and restarts");
+    behavior_shutdown();
+}
+
+static void shutdown_drains_wheel()
+{
+    reset(64);
+    BehaviorSignal sig = { 0 };
+    for (int i = 0; i < AGENTS; i++) {
+        switch (i % 4) {
+            case 0: behavior_start(i, sleeper(i, 70 + i)); break;
+            case 1: behavior_start(i, waiter(i, &sig, 200)); break;
+            case 2: behavior_start(i, waiter(i, &sig, 0)); break;
+            default: behavior_start(i, nested(i, 400), 30); break;
+        }
+    }
+    frames(4);
+    check(wheel_pending() > 0, "nothing on the wheel before shutdown");
+    behavior_shutdown();
+    check(wheel_pending() == 0, "timers left on the wheel after behavior_shutdown");
+    check(sig.head == 0, "waiters left on a signal after behavior_shutdown");
+    check(behavior_live() == 0, "live agents after behavior_shutdown");
+    printf("behavior: %d script frames torn down at shutdown\n", destroyed);
+}
+
+int main()
+{
+    resume_counts();
+    signal_or_timeout();
+    stop_and_restart();
+    shutdown_drains_wheel();
+
+    printf("behavior: %d failed\n", failed);
+    return failed ? 1 : 0;
+}
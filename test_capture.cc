@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+#include "capture.h"
+
+/// png frames must decode with zlib to the captured pixels, with valid
+/// chunk crcs and IHDR. ppm frames must follow the channel masks given.
+/// with every buffer in flight frames are dropped, counted, and leave gaps
+/// in the numbering.
+
+#define W 37
+#define H 21
+
+using namespace std;
+
+static char dir[] = "/tmp/test-capture-XXXXXX";
+static int failed;
+
+static void fail(const char* what)
+{
+    fprintf(stderr, "%s\n", what);
+    failed++;
+}
+
+static string frame_path(unsigned int frame, const char* ext)
+{
+    char path[300];
+    snprintf(path, sizeof path, "%s/frame-%06u.%s", dir, frame, ext);
+    return path;
+}
+
+static bool read_file(const string& path, vector<unsigned char>* out)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) return false;
+    out->clear();
+    unsigned char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof buf, fp)) > 0) {
+        out->insert(out->end(), buf, buf + n);
+    }
+    fclose(fp);
+    return true;
+}
+
+static uint32_t be32(const unsigned char* p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/// walks the chunks, checks every crc and the IHDR, and compares the
+/// inflated rows against px (0xAARRGGBB)
+static void check_png(const string& path, const vector<uint32_t>& px)
+{
+    static const unsigned char sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    vector<unsigned char> f, idat;
+    if (!read_file(path, &f)) return fail("png: frame missing");
+    if (f.size() < 8 || memcmp(f.data(), sig, 8)) return fail("png: bad signature");
+
+    bool ihdr = false, iend = false;
+    for (size_t at = 8; at + 12 <= f.size() && !iend; ) {
+        uint32_t len = be32(&f[at]);
+        if (at + 12 + len > f.size()) return fail("png: chunk runs past the end");
+        const unsigned char* type = &f[at + 4];
+        const unsigned char* data = &f[at + 8];
+        if (crc32(crc32(0, type, 4), data, len) != be32(data + len)) return fail("png: bad chunk crc");
+
+        if (!memcmp(type, "IHDR", 4)) {
+            // 8bit truecolor, deflate, adaptive filters, not interlaced
+            ihdr = len == 13 && be32(data) == W && be32(data + 4) == H &&
+                data[8] == 8 && data[9] == 2 && !data[10] && !data[11] && !data[12];
+        } else if (!memcmp(type, "IDAT", 4)) {
+            idat.insert(idat.end(), data, data + len);
+        } else if (!memcmp(type, "IEND", 4)) {
+            iend = true;
+        }
+        at += 12 + len;
+    }
+    if (!ihdr) return fail("png: bad or missing IHDR");
+    if (!iend) return fail("png: missing IEND");
+
+    vector<unsigned char> raw(H * (1 + W * 3));
+    uLongf raw_len = raw.size();
+    if (uncompress(raw.data(), &raw_len, idat.data(), idat.size()) != Z_OK || raw_len != raw.size()) {
+        return fail("png: IDAT does not inflate to the image size");
+    }
+    for (int y = 0; y < H; y++) {
+        const unsigned char* row = &raw[y * (1 + W * 3)];
+        if (row[0] != 0) return fail("png: row filter is not None");
+        for (int x = 0; x < W; x++) {
+            uint32_t p = px[y * W + x];
+            const unsigned char* rgb = row + 1 + x * 3;
+            if (rgb[0] != (p >> 16 & 0xff) || rgb[1] != (p >> 8 & 0xff) || rgb[2] != (p & 0xff)) {
+                return fail("png: pixels differ from the captured frame");
+            }
+        }
+    }
+}
+
+/// px in the layout masks describes must come out as the same RGB
+static void check_ppm(const string& path, const vector<uint32_t>& px, CaptureMasks m)
+{
+    vector<unsigned char> f;
+    if (!read_file(path, &f)) return fail("ppm: frame missing");
+
+    char head[32];
+    int n = snprintf(head, sizeof head, "P6\n%d %d\n255\n", W, H);
+    if (f.size() != n + W * H * 3u || memcmp(f.data(), head, n)) return fail("ppm: bad header or size");
+
+    for (int i = 0; i < W * H; i++) {
+        const unsigned char* rgb = &f[n + i * 3];
+        uint32_t p = px[i];
+        if (rgb[0] != (p & m.r) >> __builtin_ctz(m.r) || rgb[1] != (p & m.g) >> __builtin_ctz(m.g) ||
+                rgb[2] != (p & m.b) >> __builtin_ctz(m.b)) {
+            return fail("ppm: channels do not follow the masks");
+        }
+    }
+}
+
+int main()
+{
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    vector<uint32_t> px(W * H);
+    for (int i = 0; i < W * H; i++) px[i] = 0xff000000 | (i * 2654435761u & 0xffffff);
+    Pixmap p = pixmap_wrap(px.data(), W, H, W * 4);
+
+    // two buffers held by the render side, the other 48 frames find none
+    capture_start(dir, CAPTURE_PNG, W, H, 2, CAPTURE_ARGB);
+    uint32_t* a = capture_acquire();
+    uint32_t* b = capture_acquire();
+    if (!a || !b) fail("pool of 2 did not hand out 2 buffers");
+    for (int i = 2; i < 50; i++) {
+        if (capture_acquire()) fail("buffer handed out while the pool is empty");
+    }
+    if (a && b) {
+        memcpy(a, px.data(), W * H * 4);
+        memcpy(b, px.data(), W * H * 4);
+        capture_submit(a);
+        capture_submit(b);
+    }
+    capture_stop();
+
+    CaptureStats s = capture_stats();
+    printf("capture: 50 frames, %u written, %u dropped\n", s.written, s.dropped);
+    if (s.captured != 2 || s.written != 2 || s.dropped != 48 || s.failed) fail("wrong drop accounting");
+    check_png(frame_path(0, "png"), px);
+    check_png(frame_path(1, "png"), px);
+    if (access(frame_path(2, "png").c_str(), F_OK) == 0) fail("dropped frame 2 was written");
+
+    // RGBA8888 as main() asks SDL for, written through capture_frame()
+    CaptureMasks rgba = { 0xff000000, 0x00ff0000, 0x0000ff00 };
+    capture_start(dir, CAPTURE_PPM, W, H, 2, rgba);
+    capture_frame(&p);
+    capture_stop();
+    check_ppm(frame_path(0, "ppm"), px, rgba);
+
+    CaptureMasks nibbles = { 0x0f00, 0x00f0, 0x000f };
+    if (capture_start(dir, CAPTURE_PPM, W, H, 2, nibbles)) {
+        fail("masks that are not whole bytes were accepted");
+        capture_stop();
+    }
+
+    for (int i = 0; i < 2; i++) unlink(frame_path(i, "png").c_str());
+    unlink(frame_path(0, "ppm").c_str());
+    rmdir(dir);
+
+    printf("capture: %d failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include "composite.h"
+
+/// every kernel level the cpu has must match the scalar reference bit for
+/// bit on random pixmaps, rects and colors, clipping included. a copy must
+/// also match the scaled copy at 1:1, border clearing included.
+
+#define CASES 3000
+
+using namespace std;
+
+static mt19937 rng(1);
+
+static uint32_t random_pixel()
+{
+    int a = rng() % 4 == 0 ? 0xff : (rng() % 4 == 0 ? 0 : rng() % 256);
+    return composite_rgba(rng() % 256, rng() % 256, rng() % 256, a);
+}
+
+static void randomize(vector<uint32_t>& px)
+{
+    for (auto& p : px) p = random_pixel();
+}
+
+int main()
+{
+    CompositeImpl best = composite_select(COMPOSITE_AVX2);
+    int failed = 0;
+
+    for (int c = 0; c < CASES; c++) {
+        int dw = 1 + rng() % 70, dh = 1 + rng() % 40;
+        int sw = 1 + rng() % 70, sh = 1 + rng() % 40;
+        vector<uint32_t> src(sw * sh), start(dw * dh), ref;
+        randomize(src);
+        randomize(start);
+        Pixmap s = pixmap_wrap(src.data(), sw, sh, sw * 4);
+
+        int dx = (int)(rng() % 100) - 30, dy = (int)(rng() % 60) - 20;
+        int sx = (int)(rng() % 20) - 5, sy = (int)(rng() % 20) - 5;
+        int w = rng() % 80, h = rng() % 50;
+        uint32_t color = random_pixel();
+        int op = c % 3;
+
+        for (int impl = COMPOSITE_SCALAR; impl <= best; impl++) {
+            composite_select((CompositeImpl)impl);
+            vector<uint32_t> dst = start;
+            Pixmap d = pixmap_wrap(dst.data(), dw, dh, dw * 4);
+            switch (op) {
+                case 0: composite_over(&d, dx, dy, &s, sx, sy, w, h); break;
+                case 1: composite_fill(&d, dx, dy, w, h, color); break;
+                default: composite_copy(&d, &s, sx, sy); break;
+            }
+
+            if (impl == COMPOSITE_SCALAR) {
+                ref = dst;
+            } else if (dst != ref) {
+                fprintf(stderr, "case %d: %s differs from scalar (op %d, dst %dx%d, rect %d,%d %dx%d)\n",
+                        c, composite_impl_name((CompositeImpl)impl), op, dw, dh, dx, dy, w, h);
+                failed++;
+            }
+        }
+
+        if (op == 2) {
+            vector<uint32_t> dst = start;
+            Pixmap d = pixmap_wrap(dst.data(), dw, dh, dw * 4);
+            composite_copy_scaled(&d, &s, sx, sy, 1 << 16);
+            if (dst != ref) {
+                fprintf(stderr, "case %d: copy differs from scaled copy at 1:1 (dst %dx%d, src %dx%d at %d,%d)\n",
+                        c, dw, dh, sw, sh, sx, sy);
+                failed++;
+            }
+        }
+    }
+
+    printf("composite: %d cases, scalar..%s, %d failed\n", CASES, composite_impl_name(best), failed);
+    return failed ? 1 : 0;
+}
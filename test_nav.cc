@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+
+#include "nav.h"
+
+/// fields repaired after nav_set_passable() must point exactly where a full
+/// rebuild on the new map would, checked against a plain bellman-ford
+
+#define GW 40
+#define GH 30
+#define ROUNDS 300
+
+using namespace std;
+
+static mt19937 rng(1);
+static uint8_t cost[GW * GH];
+
+static void reference(int dest, uint8_t* dirs)
+{
+    const uint32_t inf = 0xffffffff;
+    vector<uint32_t> d(GW * GH, inf);
+    if (cost[dest]) d[dest] = 0;
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (int c = 0; c < GW * GH; c++) {
+            if (!cost[c]) continue;
+            int x = c % GW, y = c / GW;
+            int nb[4] = { y > 0 ? c - GW : -1, y < GH-1 ? c + GW : -1,
+                          x < GW-1 ? c + 1 : -1, x > 0 ? c - 1 : -1 };
+            for (int k = 0; k < 4; k++) {
+                if (nb[k] >= 0 && d[nb[k]] != inf && d[nb[k]] + cost[c] < d[c]) {
+                    d[c] = d[nb[k]] + cost[c];
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (int c = 0; c < GW * GH; c++) {
+        int x = c % GW, y = c / GW;
+        uint32_t bd = d[c];
+        uint8_t best = NAV_NONE;
+        if (c != dest && bd != inf) {
+            if (y > 0 && d[c - GW] < bd) bd = d[c - GW], best = NAV_UP;
+            if (y < GH-1 && d[c + GW] < bd) bd = d[c + GW], best = NAV_DOWN;
+            if (x < GW-1 && d[c + 1] < bd) bd = d[c + 1], best = NAV_RIGHT;
+            if (x > 0 && d[c - 1] < bd) bd = d[c - 1], best = NAV_LEFT;
+        }
+        dirs[c] = best;
+    }
+}
+
+static bool matches(int field, const uint8_t* dirs)
+{
+    for (int c = 0; c < GW * GH; c++) {
+        int x = (c % GW) * NAV_CELL + NAV_CELL/2, y = (c / GW) * NAV_CELL + NAV_CELL/2;
+        if (nav_dir(field, x, y) != dirs[c]) return false;
+    }
+    return true;
+}
+
+/// poll until the field shows the expected result, the worker runs behind
+static bool settle(int field, int dest)
+{
+    uint8_t dirs[GW * GH];
+    reference(dest, dirs);
+    for (int i = 0; i < 2000; i++) {
+        nav_poll();
+        if (matches(field, dirs)) return true;
+        usleep(1000);
+    }
+    return false;
+}
+
+int main()
+{
+    // gray levels for the step costs 1, 2, 3 and blocked
+    static const uint8_t luma[4] = { 255, 200, 150, 0 };
+    static const uint8_t step[4] = { 1, 2, 3, 0 };
+    vector<uint32_t> px(GW * NAV_CELL * GH * NAV_CELL);
+    for (int c = 0; c < GW * GH; c++) {
+        int k = rng() % 8 == 0 ? 3 : rng() % 3;
+        cost[c] = step[k];
+        uint32_t v = 0xff000000 | luma[k] * 0x010101;
+        int x0 = (c % GW) * NAV_CELL, y0 = (c / GW) * NAV_CELL;
+        for (int y = y0; y < y0 + NAV_CELL; y++) {
+            for (int x = x0; x < x0 + NAV_CELL; x++) px[y * GW * NAV_CELL + x] = v;
+        }
+    }
+    Pixmap mask = pixmap_wrap(px.data(), GW * NAV_CELL, GH * NAV_CELL, GW * NAV_CELL * 4);
+    nav_init(&mask, mask.w, mask.h, NAV_CELL);
+
+    int failed = 0;
+    int dest[3], field[3];
+    for (int i = 0; i < 3; i++) {
+        do {
+            dest[i] = rng() % (GW * GH);
+        } while (!cost[dest[i]]);
+        field[i] = nav_acquire((dest[i] % GW) * NAV_CELL, (dest[i] / GW) * NAV_CELL);
+    }
+
+    for (int r = 0; r < ROUNDS; r++) {
+        // a few edits per round so repairs see unions of rects, some of
+        // them over a destination
+        for (int e = 1 + rng() % 3; e--; ) {
+            int x = rng() % GW, y = rng() % GH;
+            int w = 1 + rng() % 4, h = 1 + rng() % 4;
+            bool open = rng() % 2;
+            nav_set_passable(x * NAV_CELL, y * NAV_CELL, w * NAV_CELL, h * NAV_CELL, open);
+            for (int gy = y; gy < y + h && gy < GH; gy++) {
+                for (int gx = x; gx < x + w && gx < GW; gx++) cost[gy * GW + gx] = open ? 1 : 0;
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            if (!settle(field[i], dest[i])) {
+                fprintf(stderr, "round %d: field toward cell %d differs from a full build\n", r, dest[i]);
+                failed++;
+            }
+        }
+    }
+
+    nav_shutdown();
+    printf("nav: %d rounds, %d failed\n", ROUNDS, failed);
+    return failed ? 1 : 0;
+}
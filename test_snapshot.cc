@@ -0,0 +1,154 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "snapshot.h"
+
+/// a full table saved through the writer thread must map back bit for bit,
+/// view and rng included. a flipped byte anywhere the crc covers, a short
+/// file, another version or record size must all be refused, and staging
+/// more sprites than snapshot_start() made room for must fail.
+///
+/// MAX is the SDL frontend's sprite cap, the restore is timed at that size.
+
+#define MAX 4096
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static char dir[] = "/tmp/test-snapshot-XXXXXX";
+static string path, bad;
+static mt19937 rng(1);
+static int failed;
+
+static void fail(const char* what)
+{
+    fprintf(stderr, "%s\n", what);
+    failed++;
+}
+
+static void random_bytes(void* p, size_t len)
+{
+    unsigned char* b = (unsigned char*)p;
+    for (size_t i = 0; i < len; i++) b[i] = rng();
+}
+
+static bool read_file(const string& p, vector<unsigned char>* out)
+{
+    FILE* fp = fopen(p.c_str(), "rb");
+    if (!fp) return false;
+    fseek(fp, 0, SEEK_END);
+    out->resize(ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+    bool ok = fread(out->data(), 1, out->size(), fp) == out->size();
+    fclose(fp);
+    return ok;
+}
+
+/// writes f to the scratch path, true if snapshot_open() takes it
+static bool opens(const vector<unsigned char>& f, size_t len)
+{
+    FILE* fp = fopen(bad.c_str(), "wb");
+    if (!fp) return false;
+    fwrite(f.data(), 1, len, fp);
+    fclose(fp);
+
+    Snapshot s;
+    bool ok = snapshot_open(bad.c_str(), &s);
+    snapshot_close(&s);
+    return ok;
+}
+
+/// the file with one byte at off flipped must be refused
+static void refuse_flip(const vector<unsigned char>& f, size_t off, const char* what)
+{
+    vector<unsigned char> g = f;
+    g[off] ^= 0x40;
+    if (opens(g, g.size())) fail(what);
+}
+
+int main()
+{
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    path = string(dir) + "/scene";
+    bad = string(dir) + "/bad";
+
+    vector<SnapSprite> table(MAX);
+    random_bytes(table.data(), table.size() * sizeof(SnapSprite));
+    SnapView view;
+    random_bytes(&view, sizeof view);
+    SnapRng saved_rng(7);
+    saved_rng.discard(1234);
+
+    snapshot_start(path.c_str(), MAX);
+    if (snapshot_begin(MAX + 1)) fail("staged more sprites than the writer has room for");
+    SnapSprite* rec = snapshot_begin(MAX, true);
+    if (!rec) {
+        fail("no staging records for a full table");
+    } else {
+        memcpy(rec, table.data(), MAX * sizeof(SnapSprite));
+        snapshot_commit(&view, MAX, saved_rng);
+    }
+    snapshot_stop();
+
+    // round trip, timed the way restore_scene() uses it
+    Snapshot s;
+    vector<SnapSprite> back(MAX);
+    Clock::time_point t0 = Clock::now();
+    bool ok = snapshot_open(path.c_str(), &s);
+    if (ok) memcpy(back.data(), s.sprites, s.count * sizeof(SnapSprite));
+    double ms = chrono::duration<double, milli>(Clock::now() - t0).count();
+    if (!ok) {
+        fail("saved snapshot does not open");
+    } else {
+        printf("snapshot: %d sprites restored in %.2fms\n", s.count, ms);
+        SnapRng r;
+        if (s.count != MAX || memcmp(back.data(), table.data(), MAX * sizeof(SnapSprite))) {
+            fail("records differ after the round trip");
+        }
+        if (memcmp(&s.header->view, &view, sizeof view)) fail("view differs after the round trip");
+        if (!snapshot_restore_rng(&s, &r) || r != saved_rng) fail("rng differs after the round trip");
+    }
+    snapshot_close(&s);
+
+    vector<unsigned char> f;
+    if (!read_file(path, &f)) fail("snapshot file missing");
+    size_t records = sizeof(SnapHeader);
+    size_t text = records + MAX * sizeof(SnapSprite);
+    if (f.size() > text) {
+        if (!opens(f, f.size())) fail("unmodified copy refused");
+
+        refuse_flip(f, 0, "bad magic accepted");
+        refuse_flip(f, offsetof(SnapHeader, view) + sizeof(SnapView) / 2, "corrupt view accepted");
+        refuse_flip(f, records + 17, "corrupt first record accepted");
+        refuse_flip(f, text - 1, "corrupt last record accepted");
+        refuse_flip(f, f.size() - 1, "corrupt rng state accepted");
+
+        refuse_flip(f, offsetof(SnapHeader, version), "other version accepted");
+        refuse_flip(f, offsetof(SnapHeader, record_size), "other record size accepted");
+        refuse_flip(f, offsetof(SnapHeader, count), "wrong count accepted");
+
+        if (opens(f, f.size() - 1)) fail("file short of a byte accepted");
+        if (opens(f, text)) fail("file without rng state accepted");
+        if (opens(f, records)) fail("header alone accepted");
+        if (opens(f, records - 1)) fail("partial header accepted");
+    }
+
+    unlink(path.c_str());
+    unlink(bad.c_str());
+    rmdir(dir);
+
+    printf("snapshot: %d failed\n", failed);
+    return failed ? 1 : 0;
+}
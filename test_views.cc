@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "views.h"
+
+/// views rendered on the worker pool must match a serial render pixel for
+/// pixel, and the grid must hand every view exactly the items a brute force
+/// scan finds within the margin, over layouts, scrolls and zooms
+
+#define ITEMS 5000
+#define ROUNDS 12
+#define MARGIN 16
+#define WIN_W 800
+#define WIN_H 600
+
+using namespace std;
+
+static mt19937 rng(1);
+static vector<int> xy;
+static Pixmap bg, sprite;
+static vector<int> seen[VIEW_MAX]; /// ids each view got, written by its worker
+
+static void draw(const View* v, const int* ids, int n, void* ctx)
+{
+    Pixmap dst = view_pixmap(v, (const Pixmap*)ctx);
+    if (v->zoom == 1) {
+        composite_copy(&dst, &bg, v->map_x, v->map_y);
+    } else {
+        composite_copy_scaled(&dst, &bg, v->map_x, v->map_y, view_step(v));
+    }
+
+    for (int k = 0; k < n; k++) {
+        int i = ids[k];
+        int x0 = view_lx(v, xy[2*i] - 8), y0 = view_ly(v, xy[2*i + 1] - 8);
+        if (v->zoom == 1) {
+            composite_over(&dst, x0, y0, &sprite, 0, 0, 16, 16);
+        } else {
+            composite_over_scaled(&dst, x0, y0, view_lx(v, xy[2*i] + 8) - x0,
+                                  view_ly(v, xy[2*i + 1] + 8) - y0, &sprite);
+        }
+    }
+    seen[v - view_get(0)].assign(ids, ids + n);
+}
+
+static int check_culling(int round)
+{
+    int failed = 0;
+    for (int i = 0; i < views_count(); i++) {
+        int mx, my, mw, mh;
+        view_map_rect(view_get(i), &mx, &my, &mw, &mh);
+        vector<int> want;
+        for (int k = 0; k < ITEMS; k++) {
+            int x = xy[2*k], y = xy[2*k + 1];
+            if (x >= mx - MARGIN && x < mx + mw + MARGIN && y >= my - MARGIN && y < my + mh + MARGIN) {
+                want.push_back(k);
+            }
+        }
+        vector<int> got = seen[i];
+        sort(got.begin(), got.end());
+        if (got != want) {
+            fprintf(stderr, "round %d: view %d got %d items, brute force finds %d\n",
+                    round, i, (int)got.size(), (int)want.size());
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/// only pixels inside views are drawn, the rest keeps the fill
+static bool same_views(const vector<uint32_t>& a, const vector<uint32_t>& b)
+{
+    for (int i = 0; i < views_count(); i++) {
+        const View* v = view_get(i);
+        for (int y = v->y; y < v->y + v->h; y++) {
+            if (!equal(&a[y * WIN_W + v->x], &a[y * WIN_W + v->x + v->w], &b[y * WIN_W + v->x])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static int run_layout(const char* layout, int map_w, int map_h)
+{
+    vector<uint32_t> bg_px(map_w * map_h);
+    for (auto& p : bg_px) p = rng() | 0xff000000;
+    bg = pixmap_wrap(bg_px.data(), map_w, map_h, map_w * 4);
+
+    setenv("NAVGUIDE_VIEWS", layout, 1);
+    views_init(WIN_W, WIN_H, map_w, map_h, ITEMS);
+
+    int failed = 0;
+    vector<uint32_t> serial(WIN_W * WIN_H), parallel(WIN_W * WIN_H);
+    for (int r = 0; r < ROUNDS; r++) {
+        // some items just off the map, the grid clamps them into edge cells
+        for (int k = 0; k < ITEMS; k++) {
+            xy[2*k] = (int)(rng() % (map_w + 40)) - 20;
+            xy[2*k + 1] = (int)(rng() % (map_h + 40)) - 20;
+        }
+        for (int i = 0; i < views_count(); i++) {
+            View* v = view_get(i);
+            if (rng() % 3 == 0) {
+                view_zoom(v, rng() % 2 ? 2.0f : 0.5f, v->x + rng() % v->w, v->y + rng() % v->h);
+            }
+            view_scroll(v, (int)(rng() % 400) - 200, (int)(rng() % 400) - 200);
+        }
+        views_index(xy.data(), ITEMS);
+
+        // different garbage underneath, stale pixels would show as a diff
+        fill(serial.begin(), serial.end(), 0x11111111);
+        fill(parallel.begin(), parallel.end(), 0x22222222);
+        Pixmap s = pixmap_wrap(serial.data(), WIN_W, WIN_H, WIN_W * 4);
+        Pixmap p = pixmap_wrap(parallel.data(), WIN_W, WIN_H, WIN_W * 4);
+
+        views_render(draw, &s, MARGIN, false);
+        failed += check_culling(r);
+        views_render(draw, &p, MARGIN, true);
+        failed += check_culling(r);
+
+        if (!same_views(serial, parallel)) {
+            fprintf(stderr, "round %d: parallel render differs from serial (%s)\n", r, layout);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+int main()
+{
+    composite_init();
+    // workers even on a single cpu
+    setenv("NAVGUIDE_VIEW_THREADS", "3", 1);
+
+    xy.resize(2 * ITEMS);
+    vector<uint32_t> sprite_px(16 * 16);
+    for (int i = 0; i < 256; i++) sprite_px[i] = composite_rgba(200, i, 30, (i * 7) & 0xff);
+    sprite = pixmap_wrap(sprite_px.data(), 16, 16, 16 * 4);
+
+    int failed = 0;
+    failed += run_layout("0,0,400,600,0;400,0,400,300,2;400,300,400,300,1", 1500, 1000);
+    failed += run_layout("0,0,200,200,1;200,0,600,600,0.5;0,200,200,400,4", 2000, 1200);
+    // the map is smaller than the views, they center it with a border
+    failed += run_layout("0,0,400,600,1;400,0,400,600,1", 300, 200);
+    views_shutdown();
+
+    printf("views: 3 layouts, %d rounds each, %d failed\n", ROUNDS, failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+
+#include <random>
+#include <vector>
+
+#include "wheel.h"
+
+/// random adds, cancels and re-adds from callbacks over every wheel level
+/// and across the clock wrap: each timer fires exactly once, never before
+/// its deadline and no later than the first wheel_advance() that reaches it
+
+#define CAPACITY 512
+#define STEPS 20000
+#define MAX_DELAY (1u << 24) /// stays inside the wheel range, nothing is clamped
+
+using namespace std;
+
+typedef struct {
+    unsigned int expires;
+    unsigned int due_by; /// first advance that must have fired it
+    int id;
+    bool live;
+} Rec;
+
+static mt19937 rng(1);
+static vector<Rec> recs;
+static int by_id[CAPACITY]; /// record of each live timer, -1 for none
+static unsigned int last_now; /// clock of the last or running advance
+static int fired, cancelled, failed;
+
+static void on_fire(int owner, unsigned int now);
+
+static unsigned int random_delay()
+{
+    // mostly short, some on every higher level
+    switch (rng() % 8) {
+        case 0: return rng() % MAX_DELAY;
+        case 1: return rng() % (1u << 18);
+        case 2: return rng() % (1u << 12);
+        default: return rng() % 64;
+    }
+}
+
+static void add(unsigned int expires)
+{
+    int r = recs.size();
+    int id = wheel_add(expires, on_fire, r);
+    if (id < 0) return; // pool full
+
+    // a deadline already behind the clock is due on the next advance
+    unsigned int next = last_now + 1;
+    Rec rec = { expires, (int)(expires - next) > 0 ? expires : next, id, true };
+    recs.push_back(rec);
+    if (by_id[id] >= 0) {
+        fprintf(stderr, "timer %d handed out while still live\n", id);
+        failed++;
+    }
+    by_id[id] = r;
+}
+
+static void cancel_random()
+{
+    int id = rng() % CAPACITY;
+    if (by_id[id] < 0) return;
+    recs[by_id[id]].live = false;
+    by_id[id] = -1;
+    wheel_cancel(id);
+    cancelled++;
+}
+
+static void on_fire(int owner, unsigned int now)
+{
+    Rec& r = recs[owner];
+    if (!r.live) {
+        fprintf(stderr, "timer %d fired after it was cancelled or fired\n", owner);
+        failed++;
+        return;
+    }
+    if ((int)(now - r.expires) < 0) {
+        fprintf(stderr, "timer %d fired early: now %u, expires %u\n", owner, now, r.expires);
+        failed++;
+    }
+    r.live = false;
+    by_id[r.id] = -1;
+    fired++;
+
+    // callbacks re-add, some with a deadline already passed, and cancel
+    // others, possibly ones in the slot being run
+    if (rng() % 2) add(now + random_delay() - (rng() % 4 == 0 ? 8 : 0));
+    if (rng() % 4 == 0) cancel_random();
+}
+
+int main()
+{
+    for (int i = 0; i < CAPACITY; i++) by_id[i] = -1;
+
+    unsigned int now = 0xfff00000;
+    last_now = now;
+    wheel_init(now, CAPACITY);
+
+    for (int s = 0; s < STEPS; s++) {
+        for (int k = rng() % 4; k--; ) add(now + random_delay());
+        if (rng() % 8 == 0) cancel_random();
+
+        now += rng() % 16 == 0 ? rng() % 20000 : 1 + rng() % 16;
+        last_now = now;
+        wheel_advance(now);
+
+        int live = 0;
+        for (int id = 0; id < CAPACITY; id++) {
+            if (by_id[id] < 0) continue;
+            Rec& r = recs[by_id[id]];
+            if ((int)(now - r.due_by) >= 0) {
+                fprintf(stderr, "timer %d late: now %u, due by %u\n", by_id[id], now, r.due_by);
+                failed++;
+                r.live = false;
+                by_id[id] = -1;
+                wheel_cancel(id);
+                continue;
+            }
+            live++;
+        }
+        if (live != wheel_pending()) {
+            fprintf(stderr, "step %d: %d live timers, wheel has %d\n", s, live, wheel_pending());
+            failed++;
+        }
+    }
+
+    printf("wheel: %d timers, %d fired, %d cancelled, %d failed\n",
+           (int)recs.size(), fired, cancelled, failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,348 @@
+#include "views.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "alloc_count.h"
+
+using namespace std;
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static struct {
+    View views[VIEW_MAX];
+    int count;
+    int map_w, map_h;
+    vector<int> visible[VIEW_MAX]; /// per view culling result
+} vs;
+
+/// items bucketed by grid cell, cells in row major order so the cells of
+/// one grid row a view spans are one contiguous run
+static struct {
+    int cols, rows;
+    int capacity;
+    vector<int> start; /// first item of each cell, one extra at the end
+    vector<int> fill;
+    vector<int> cell;  /// cell of each input item
+    vector<int> ids;   /// item ids in cell order
+    vector<int> xy;    /// and their points
+} grid;
+
+static struct {
+    vector<thread> workers;
+    mutex lock;
+    condition_variable go, done;
+    int next, count, finished; /// views claimed, to run, done this round
+    bool stopping;
+
+    ViewFn fn;
+    void* ctx;
+    int margin;
+} pool;
+
+static float fit_zoom(const View* v)
+{
+    return MIN((float)v->w / vs.map_w, (float)v->h / vs.map_h);
+}
+
+/// keep the view on the map, centered on an axis the map doesn't fill
+static void clamp_view(View* v)
+{
+    if (v->fit) v->zoom = fit_zoom(v);
+
+    float vw = v->w / v->zoom, vh = v->h / v->zoom;
+    if (vw >= vs.map_w) {
+        v->map_x = (int)floorf((vs.map_w - vw) / 2);
+    } else {
+        v->map_x = MIN(MAX(v->map_x, 0), vs.map_w - (int)ceilf(vw));
+    }
+    if (vh >= vs.map_h) {
+        v->map_y = (int)floorf((vs.map_h - vh) / 2);
+    } else {
+        v->map_y = MIN(MAX(v->map_y, 0), vs.map_h - (int)ceilf(vh));
+    }
+}
+
+static bool overlaps(const View* a, const View* b)
+{
+    return a->x < b->x + b->w && b->x < a->x + a->w &&
+        a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+static void add_view(int win_w, int win_h, int x, int y, int w, int h, float zoom)
+{
+    View v;
+    v.x = MAX(x, 0), v.y = MAX(y, 0);
+    v.w = MIN(x + w, win_w) - v.x;
+    v.h = MIN(y + h, win_h) - v.y;
+    if (v.w <= 0 || v.h <= 0) {
+        fprintf(stderr, "views: %d,%d %dx%d is off the window, ignored\n", x, y, w, h);
+        return;
+    }
+    // views render concurrently into the one window, they must not share
+    // pixels
+    for (int i = 0; i < vs.count; i++) {
+        if (overlaps(&v, &vs.views[i])) {
+            fprintf(stderr, "views: %d,%d %dx%d overlaps view %d, ignored\n", x, y, w, h, i);
+            return;
+        }
+    }
+
+    v.map_x = v.map_y = 0;
+    v.fit = zoom <= 0;
+    v.zoom = v.fit ? 1 : MIN(zoom, VIEW_ZOOM_MAX);
+    clamp_view(&v);
+    vs.views[vs.count++] = v;
+}
+
+static void render_view(int i, ViewFn fn, void* ctx, int margin)
+{
+    const View* v = &vs.views[i];
+    int* ids = vs.visible[i].data();
+    int n = 0;
+
+    int mx, my, mw, mh;
+    view_map_rect(v, &mx, &my, &mw, &mh);
+    int x0 = mx - margin, y0 = my - margin;
+    int x1 = mx + mw + margin, y1 = my + mh + margin;
+
+    int cx0 = MAX(x0 / VIEW_CELL, 0), cx1 = MIN(x1 / VIEW_CELL, grid.cols - 1);
+    int cy0 = MAX(y0 / VIEW_CELL, 0), cy1 = MIN(y1 / VIEW_CELL, grid.rows - 1);
+    for (int cy = cy0; cy <= cy1 && cx0 <= cx1; cy++) {
+        int b = grid.start[cy * grid.cols + cx0];
+        int e = grid.start[cy * grid.cols + cx1 + 1];
+        for (int k = b; k < e; k++) {
+            int x = grid.xy[2*k], y = grid.xy[2*k + 1];
+            if (x >= x0 && x < x1 && y >= y0 && y < y1) {
+                ids[n++] = grid.ids[k];
+            }
+        }
+    }
+
+    fn(v, ids, n, ctx);
+}
+
+static void worker_main()
+{
+    unique_lock<mutex> lk(pool.lock);
+    for (;;) {
+        pool.go.wait(lk, [] { return pool.stopping || pool.next < pool.count; });
+        if (pool.stopping) break;
+
+        int i = pool.next++;
+        ViewFn fn = pool.fn;
+        void* ctx = pool.ctx;
+        int margin = pool.margin;
+        lk.unlock();
+        // the frame is the render thread's, so is the allocation check
+        unsigned long allocs = alloc_count_thread();
+        render_view(i, fn, ctx, margin);
+        alloc_count_credit(alloc_count_thread() - allocs);
+        lk.lock();
+
+        if (++pool.finished == pool.count) pool.done.notify_all();
+    }
+}
+
+void views_init(int win_w, int win_h, int map_w, int map_h, int max_items)
+{
+    views_shutdown();
+
+    vs.count = 0;
+    vs.map_w = MAX(map_w, 1), vs.map_h = MAX(map_h, 1);
+
+    const char* env = getenv("NAVGUIDE_VIEWS");
+    while (env && *env && vs.count < VIEW_MAX) {
+        int x, y, w, h, used = 0;
+        float zoom;
+        if (sscanf(env, "%d,%d,%d,%d,%f%n", &x, &y, &w, &h, &zoom, &used) != 5) {
+            fprintf(stderr, "views: can't parse NAVGUIDE_VIEWS at \"%s\"\n", env);
+            break;
+        }
+        add_view(win_w, win_h, x, y, w, h, zoom);
+        env += used;
+        if (*env == ';') env++;
+    }
+    if (!vs.count) {
+        add_view(win_w, win_h, 0, 0, win_w, win_h, 1);
+    }
+
+    grid.cols = (vs.map_w + VIEW_CELL - 1) / VIEW_CELL;
+    grid.rows = (vs.map_h + VIEW_CELL - 1) / VIEW_CELL;
+    grid.capacity = max_items;
+    grid.start.assign(grid.cols * grid.rows + 1, 0);
+    grid.fill.assign(grid.cols * grid.rows, 0);
+    grid.cell.assign(max_items, 0);
+    grid.ids.assign(max_items, 0);
+    grid.xy.assign(max_items * 2, 0);
+    for (int i = 0; i < vs.count; i++) {
+        vs.visible[i].assign(max_items, 0);
+    }
+
+    // the render thread takes a share, so one view needs no workers
+    int workers = MIN(vs.count, (int)thread::hardware_concurrency()) - 1;
+    if (const char* t = getenv("NAVGUIDE_VIEW_THREADS")) {
+        workers = MIN(atoi(t), vs.count - 1);
+    }
+    pool.next = pool.count = pool.finished = 0;
+    pool.stopping = false;
+    for (int i = 0; i < workers; i++) {
+        pool.workers.push_back(thread(worker_main));
+    }
+
+    static bool registered = false;
+    if (!registered) {
+        atexit(views_shutdown);
+        registered = true;
+    }
+
+    fprintf(stderr, "views: %d, %d render workers\n", vs.count, (int)pool.workers.size());
+}
+
+void views_shutdown()
+{
+    {
+        lock_guard<mutex> lk(pool.lock);
+        pool.stopping = true;
+    }
+    pool.go.notify_all();
+    for (size_t i = 0; i < pool.workers.size(); i++) {
+        pool.workers[i].join();
+    }
+    pool.workers.clear();
+}
+
+int views_count()
+{
+    return vs.count;
+}
+
+View* view_get(int i)
+{
+    return &vs.views[i];
+}
+
+int view_at(int x, int y)
+{
+    for (int i = 0; i < vs.count; i++) {
+        const View* v = &vs.views[i];
+        if (x >= v->x && x < v->x + v->w && y >= v->y && y < v->y + v->h) return i;
+    }
+    return -1;
+}
+
+/// window pixels to map pixels, zoomed in views still move
+static int map_len(const View* v, int d)
+{
+    if (!d) return 0;
+    int n = (int)lroundf(d / v->zoom);
+    return n ? n : (d > 0 ? 1 : -1);
+}
+
+void view_scroll(View* v, int dx, int dy)
+{
+    v->map_x += map_len(v, dx);
+    v->map_y += map_len(v, dy);
+    clamp_view(v);
+}
+
+void view_place(View* v, int map_x, int map_y)
+{
+    v->map_x = map_x;
+    v->map_y = map_y;
+    clamp_view(v);
+}
+
+void view_zoom(View* v, float factor, int wx, int wy)
+{
+    float lo = MIN(fit_zoom(v), 1.0f);
+    float z = MIN(MAX(v->zoom * factor, lo), VIEW_ZOOM_MAX);
+
+    // map point under the cursor stays put
+    float mx = v->map_x + (wx - v->x) / v->zoom;
+    float my = v->map_y + (wy - v->y) / v->zoom;
+    v->zoom = z;
+    v->fit = z == fit_zoom(v);
+    v->map_x = (int)lroundf(mx - (wx - v->x) / z);
+    v->map_y = (int)lroundf(my - (wy - v->y) / z);
+    clamp_view(v);
+}
+
+void view_map_rect(const View* v, int* x, int* y, int* w, int* h)
+{
+    int x0 = MAX(v->map_x, 0), y0 = MAX(v->map_y, 0);
+    int x1 = MIN(v->map_x + (int)ceilf(v->w / v->zoom), vs.map_w);
+    int y1 = MIN(v->map_y + (int)ceilf(v->h / v->zoom), vs.map_h);
+    *x = x0, *y = y0;
+    *w = MAX(x1 - x0, 0), *h = MAX(y1 - y0, 0);
+}
+
+Pixmap view_pixmap(const View* v, const Pixmap* window)
+{
+    Pixmap p = *window;
+    int x = MIN(v->x, p.w), y = MIN(v->y, p.h);
+    p.pixels += y * p.stride + x;
+    p.w = MIN(v->w, p.w - x);
+    p.h = MIN(v->h, p.h - y);
+    return p;
+}
+
+void views_index(const int* xy, int n)
+{
+    n = MIN(n, grid.capacity);
+    int cells = grid.cols * grid.rows;
+    for (int c = 0; c <= cells; c++) grid.start[c] = 0;
+
+    for (int i = 0; i < n; i++) {
+        int cx = MIN(MAX(xy[2*i] / VIEW_CELL, 0), grid.cols - 1);
+        int cy = MIN(MAX(xy[2*i + 1] / VIEW_CELL, 0), grid.rows - 1);
+        int c = cy * grid.cols + cx;
+        grid.cell[i] = c;
+        grid.start[c + 1]++;
+    }
+    for (int c = 0; c < cells; c++) {
+        grid.start[c + 1] += grid.start[c];
+        grid.fill[c] = grid.start[c];
+    }
+    for (int i = 0; i < n; i++) {
+        int k = grid.fill[grid.cell[i]]++;
+        grid.ids[k] = i;
+        grid.xy[2*k] = xy[2*i];
+        grid.xy[2*k + 1] = xy[2*i + 1];
+    }
+}
+
+void views_render(ViewFn fn, void* ctx, int margin, bool parallel)
+{
+    if (!parallel || pool.workers.empty()) {
+        for (int i = 0; i < vs.count; i++) {
+            render_view(i, fn, ctx, margin);
+        }
+        return;
+    }
+
+    unique_lock<mutex> lk(pool.lock);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.margin = margin;
+    pool.next = pool.finished = 0;
+    pool.count = vs.count;
+    pool.go.notify_all();
+
+    // take views ourselves until all are claimed
+    while (pool.next < pool.count) {
+        int i = pool.next++;
+        lk.unlock();
+        render_view(i, fn, ctx, margin);
+        lk.lock();
+        ++pool.finished;
+    }
+    pool.done.wait(lk, [] { return pool.finished == pool.count; });
+    pool.count = 0;
+}
@@ -0,0 +1,82 @@
+#ifndef NAVGUIDE_VIEWS_H
+#define NAVGUIDE_VIEWS_H
+
+#include <math.h>
+
+#include "composite.h"
+
+/// several views onto the one shared map, each with its own scroll, zoom
+/// and culling.
+///
+/// the simulation stays single. once per frame views_index() buckets every
+/// sprite into a coarse grid over the map, shared by all views, so a view
+/// only visits the cells it shows and costs its visible sprites.
+/// views_render() hands the views to a small worker pool; every view draws
+/// into its own part of the window, so the composite kernels need no
+/// locking.
+///
+/// NAVGUIDE_VIEWS="x,y,w,h,zoom;..." lays views out in window pixels, zoom
+/// 0 fits the whole map. unset is one 1:1 view over the whole window.
+/// NAVGUIDE_VIEW_THREADS caps the render workers.
+
+#define VIEW_MAX 8
+#define VIEW_CELL 128 /// grid cell, map pixels
+#define VIEW_ZOOM_MAX 8.0f
+
+typedef struct {
+    int x, y, w, h;   /// rect in the window
+    int map_x, map_y; /// map point at the top left of the view
+    float zoom;       /// window pixels per map pixel
+    bool fit;         /// zoom tracks the view size so the whole map shows
+} View;
+
+/// max_items bounds what views_index() gets, all buffers are sized here
+void views_init(int win_w, int win_h, int map_w, int map_h, int max_items);
+void views_shutdown();
+
+int views_count();
+View* view_get(int i);
+/// view under a window point, -1 for none
+int view_at(int x, int y);
+
+/// scroll by window pixels, at least a map pixel, clamped to the map
+void view_scroll(View* v, int dx, int dy);
+/// put map point (map_x, map_y) at the top left, clamped to the map
+void view_place(View* v, int map_x, int map_y);
+/// zoom by factor keeping the map point under window point (wx, wy) put
+void view_zoom(View* v, float factor, int wx, int wy);
+
+/// part of the map the view shows, clipped to the map
+void view_map_rect(const View* v, int* x, int* y, int* w, int* h);
+
+/// map coordinates to pixels from the view's top left
+static inline int view_lx(const View* v, int mx)
+{
+    return (int)floorf((mx - v->map_x) * v->zoom);
+}
+
+static inline int view_ly(const View* v, int my)
+{
+    return (int)floorf((my - v->map_y) * v->zoom);
+}
+
+/// src pixels per view pixel, 16.16 as composite_copy_scaled() takes it
+static inline uint32_t view_step(const View* v)
+{
+    return (uint32_t)(65536.0f / v->zoom);
+}
+
+/// the view's part of a window sized pixmap, clipping stays inside the view
+Pixmap view_pixmap(const View* v, const Pixmap* window);
+
+/// bucket this frame's items, xy holds n map points (x0, y0, x1, y1, ...)
+void views_index(const int* xy, int n);
+
+/// ids are the indexed items within margin map pixels of the view
+typedef void (*ViewFn)(const View* v, const int* ids, int n, void* ctx);
+
+/// call fn for every view, on the render workers when parallel is set, and
+/// return once all are done
+void views_render(ViewFn fn, void* ctx, int margin, bool parallel);
+
+#endif
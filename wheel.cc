@@ -0,0 +1,193 @@
+#include "wheel.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+using namespace std;
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_RANGE (1u << (WHEEL_BITS * WHEEL_LEVELS))
+
+typedef struct {
+    unsigned int expires;
+    TimerFn fn;   /// NULL while on the free list
+    int owner;
+    int next, prev;
+    short level, slot; /// level -1: detached and about to fire
+} Timer;
+
+static struct {
+    vector<Timer> pool;
+    int free_head;
+    int pending;
+
+    int head[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t occupied[WHEEL_LEVELS];
+    int firing; /// slot being run, callbacks may cancel timers in it
+    unsigned int cur; /// next tick to process
+} wheel;
+
+static void link(int id, int level, int slot)
+{
+    Timer& t = wheel.pool[id];
+    t.level = level;
+    t.slot = slot;
+    t.prev = -1;
+    t.next = wheel.head[level][slot];
+    if (t.next >= 0) wheel.pool[t.next].prev = id;
+    wheel.head[level][slot] = id;
+    wheel.occupied[level] |= (uint64_t)1 << slot;
+}
+
+static void unlink(int id)
+{
+    Timer& t = wheel.pool[id];
+    if (t.prev >= 0) {
+        wheel.pool[t.prev].next = t.next;
+    } else if (t.level < 0) {
+        wheel.firing = t.next;
+    } else {
+        wheel.head[t.level][t.slot] = t.next;
+        if (t.next < 0) wheel.occupied[t.level] &= ~((uint64_t)1 << t.slot);
+    }
+    if (t.next >= 0) wheel.pool[t.next].prev = t.prev;
+}
+
+/// file a timer by how far away it is from the next tick
+static void place(int id)
+{
+    Timer& t = wheel.pool[id];
+    unsigned int delta = t.expires - wheel.cur;
+    if ((int)delta < 0) {
+        // already due, goes into the very next tick
+        t.expires = wheel.cur;
+        delta = 0;
+    } else if (delta >= WHEEL_RANGE) {
+        t.expires = wheel.cur + WHEEL_RANGE - 1;
+        delta = WHEEL_RANGE - 1;
+    }
+
+    int level = 0;
+    while (delta >= (1u << (WHEEL_BITS * (level + 1)))) level++;
+    link(id, level, (t.expires >> (WHEEL_BITS * level)) & WHEEL_MASK);
+}
+
+/// move the current slot of a higher level down, returns its index so the
+/// caller knows whether the next level wrapped too
+static int cascade(int level)
+{
+    int slot = (wheel.cur >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    int id = wheel.head[level][slot];
+    wheel.head[level][slot] = -1;
+    wheel.occupied[level] &= ~((uint64_t)1 << slot);
+
+    while (id >= 0) {
+        int next = wheel.pool[id].next;
+        place(id);
+        id = next;
+    }
+    return slot;
+}
+
+static void release(int id)
+{
+    Timer& t = wheel.pool[id];
+    t.fn = NULL;
+    t.next = wheel.free_head;
+    wheel.free_head = id;
+    wheel.pending--;
+}
+
+void wheel_init(unsigned int now, int capacity)
+{
+    wheel.pool.assign(capacity, Timer());
+    for (int i = 0; i < capacity; i++) {
+        wheel.pool[i].fn = NULL;
+        wheel.pool[i].next = i + 1 < capacity ? i + 1 : -1;
+    }
+    wheel.free_head = capacity ? 0 : -1;
+    wheel.pending = 0;
+
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        for (int s = 0; s < WHEEL_SLOTS; s++) wheel.head[l][s] = -1;
+        wheel.occupied[l] = 0;
+    }
+    wheel.firing = -1;
+    wheel.cur = now;
+}
+
+int wheel_add(unsigned int expires, TimerFn fn, int owner)
+{
+    int id = wheel.free_head;
+    if (id < 0) return -1;
+    wheel.free_head = wheel.pool[id].next;
+    wheel.pending++;
+
+    Timer& t = wheel.pool[id];
+    t.expires = expires;
+    t.fn = fn;
+    t.owner = owner;
+    place(id);
+    return id;
+}
+
+void wheel_cancel(int timer)
+{
+    if (timer < 0 || !wheel.pool[timer].fn) return;
+    unlink(timer);
+    release(timer);
+}
+
+void wheel_advance(unsigned int now)
+{
+    while ((int)(now - wheel.cur) >= 0) {
+        int idx = wheel.cur & WHEEL_MASK;
+        if (idx == 0) {
+            for (int l = 1; l < WHEEL_LEVELS && cascade(l) == 0; l++)
+                ;
+        }
+
+        // jump to the next occupied slot of this round, if any is due
+        unsigned int span = now - wheel.cur;
+        if (span > (unsigned int)(WHEEL_MASK - idx)) span = WHEEL_MASK - idx;
+        uint64_t m = wheel.occupied[0] >> idx;
+        if (span < 63) m &= ((uint64_t)1 << (span + 1)) - 1;
+        if (!m) {
+            wheel.cur += span + 1;
+            continue;
+        }
+
+        wheel.cur += __builtin_ctzll(m);
+        int slot = wheel.cur & WHEEL_MASK;
+        wheel.firing = wheel.head[0][slot];
+        wheel.head[0][slot] = -1;
+        wheel.occupied[0] &= ~((uint64_t)1 << slot);
+        for (int id = wheel.firing; id >= 0; id = wheel.pool[id].next) {
+            wheel.pool[id].level = -1;
+        }
+        // past this tick before running, re-adds land in later slots
+        wheel.cur++;
+
+        while (wheel.firing >= 0) {
+            int id = wheel.firing;
+            Timer& t = wheel.pool[id];
+            wheel.firing = t.next;
+            if (t.next >= 0) wheel.pool[t.next].prev = -1;
+
+            TimerFn fn = t.fn;
+            int owner = t.owner;
+            release(id);
+            fn(owner, now);
+        }
+    }
+}
+
+int wheel_pending()
+{
+    return wheel.pending;
+}
@@ -0,0 +1,30 @@
+#ifndef NAVGUIDE_WHEEL_H
+#define NAVGUIDE_WHEEL_H
+
+/// hierarchical timing wheel for scheduled behaviour changes (sprite turns,
+/// label refresh, despawn, ...).
+///
+/// 4 levels of 64 slots at 1ms ticks, about 4.6 hours of range; later
+/// deadlines are clamped. timers live in a pool sized at init, so adding
+/// and firing never allocates. wheel_advance() skips empty slots through
+/// per level occupancy bitmaps, its cost follows the number of expired
+/// timers rather than the number of registered ones.
+
+typedef void (*TimerFn)(int owner, unsigned int now);
+
+void wheel_init(unsigned int now, int capacity);
+
+/// fire fn(owner, now) once the clock reaches expires, -1 when the pool is
+/// exhausted. a timer is gone after it fires, re-add from the callback to
+/// repeat.
+int wheel_add(unsigned int expires, TimerFn fn, int owner);
+void wheel_cancel(int timer);
+
+/// run everything due up to now, call once per frame with the frame clock.
+/// a timer added from a callback with its deadline already passed fires on
+/// the next tick.
+void wheel_advance(unsigned int now);
+
+int wheel_pending();
+
+#endif